@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
+#include "queue.h"
+
+// throughput and latency benchmark over every queue mode.
+// every item carries the time it was enqueued (in ns since the start of the benchmark), consumers record
+// now - that time into a histogram of their own (with the buckets of queueStats), which are merged when the run is over.
+// without a payload the item is that time itself. with one (and always in QUEUE_MODE_INTRUSIVE) it is an Item out of a
+// pool every producer preallocates, the producer writes its payload and the consumer reads it before it gives the Item
+// back to the pool.
+// configurations a mode does not support are skipped with a note on stderr.
+// results are printed as one CSV line (or JSON object) per run.
+
+#define DEFAULT_ITEMS 100000
+#define MAX_THREADS 16
+#define MAX_BATCH 64
+// bursty producers enqueue BURST_ITEMS and then pause for BURST_PAUSE_NS.
+#define BURST_ITEMS 1000
+#define BURST_PAUSE_NS 200000
+// consumers check whether everything was consumed at least this often.
+#define POLL_NS 10000000
+// Items every producer preallocates, a producer that finds its next Item still in flight waits for it.
+#define POOL_ITEMS 4096
+
+typedef enum Pattern
+{
+    PATTERN_STEADY,
+    PATTERN_BURSTY,
+} Pattern;
+
+typedef struct Run
+{
+    QueueMode mode;
+    int producers;
+    int consumers;
+    int batch;
+    Pattern pattern;
+    size_t payload;
+    long items_per_producer;
+} Run;
+
+// the link comes first, so the link a QUEUE_MODE_INTRUSIVE dequeue returns is the Item.
+typedef struct Item
+{
+    QueueLink link;
+    uint64_t enqueued;
+    atomic_bool in_flight;
+    unsigned char payload[];
+} Item;
+
+typedef struct Producer
+{
+    unsigned char *pool;
+} Producer;
+
+typedef struct Consumer
+{
+    uint64_t buckets[QUEUE_LATENCY_BUCKETS];
+    uint64_t max;
+    unsigned long checksum;
+} Consumer;
+
+static const char *mode_names[] = {"locked", "two_lock", "lock_free", "ring", "sharded", "spsc", "intrusive", "combining", "multi"};
+static const char *pattern_names[] = {"steady", "bursty"};
+
+static struct timespec bench_start;
+static QueueHandle *q;
+static Run current;
+static atomic_long consumed;
+static Consumer consumer_stats[MAX_THREADS];
+static Producer producer_pools[MAX_THREADS];
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - bench_start.tv_sec) * 1000000000u + (uint64_t)now.tv_nsec - (uint64_t)bench_start.tv_nsec;
+}
+
+static bool pooled(void)
+{
+    return current.mode == QUEUE_MODE_INTRUSIVE || current.payload > 0;
+}
+
+static size_t item_size(void)
+{
+    return (sizeof(Item) + current.payload + _Alignof(Item) - 1) / _Alignof(Item) * _Alignof(Item);
+}
+
+static void *make_item(Producer *producer, long index)
+{
+    Item *item;
+
+    // the item is its enqueue time, +1 so it is never NULL.
+    if (!pooled())
+        return (void *)(uintptr_t)(now_ns() + 1);
+
+    item = (Item *)(producer->pool + (size_t)(index % POOL_ITEMS) * item_size());
+    while (atomic_load_explicit(&item->in_flight, memory_order_acquire))
+        thrd_yield();
+    memset(item->payload, (unsigned char)index, current.payload);
+    atomic_store_explicit(&item->in_flight, true, memory_order_relaxed);
+    item->enqueued = now_ns();
+    return item;
+}
+
+// returns when the item was enqueued.
+static uint64_t consume_item(Consumer *stats, void *data)
+{
+    Item *item;
+    uint64_t enqueued;
+
+    if (!pooled())
+        return (uint64_t)(uintptr_t)data - 1;
+
+    item = (Item *)data;
+    enqueued = item->enqueued;
+    for (size_t i = 0; i < current.payload; i++)
+        stats->checksum += item->payload[i];
+    atomic_store_explicit(&item->in_flight, false, memory_order_release);
+    return enqueued;
+}
+
+static int produce(void *arg)
+{
+    Producer *producer = (Producer *)arg;
+    void *batch[MAX_BATCH];
+    long sent = 0;
+    int n;
+
+    while (sent < current.items_per_producer)
+    {
+        n = current.batch;
+        if (n > current.items_per_producer - sent)
+            n = (int)(current.items_per_producer - sent);
+        for (int i = 0; i < n; i++)
+            batch[i] = make_item(producer, sent + i);
+        if (n == 1)
+            queueEnqueue(q, batch[0]);
+        else
+            queueEnqueueMany(q, batch, (size_t)n);
+
+        if (current.pattern == PATTERN_BURSTY && (sent / BURST_ITEMS) != ((sent + n) / BURST_ITEMS))
+            thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = BURST_PAUSE_NS}, NULL);
+        sent += n;
+    }
+    return 0;
+}
+
+static int consume(void *arg)
+{
+    Consumer *stats = (Consumer *)arg;
+    long total = current.items_per_producer * current.producers;
+    void *batch[MAX_BATCH];
+    struct timespec deadline;
+    uint64_t now;
+    uint64_t latency;
+    size_t n;
+
+    while (atomic_load_explicit(&consumed, memory_order_relaxed) < total)
+    {
+        n = queueTryDequeueMany(q, batch, (size_t)current.batch);
+        if (n == 0)
+        {
+            timespec_get(&deadline, TIME_UTC);
+            deadline.tv_nsec += POLL_NS;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if (!queueDequeueTimeout(q, &batch[0], &deadline))
+                continue;
+            n = 1;
+        }
+
+        now = now_ns();
+        for (size_t i = 0; i < n; i++)
+        {
+            latency = now - consume_item(stats, batch[i]);
+            stats->buckets[queueLatencyBucket(latency)]++;
+            if (latency > stats->max)
+                stats->max = latency;
+        }
+        atomic_fetch_add_explicit(&consumed, (long)n, memory_order_relaxed);
+    }
+    return 0;
+}
+
+static uint64_t percentile(uint64_t *buckets, uint64_t count, uint64_t max, double quantile)
+{
+    uint64_t rank = (uint64_t)(quantile * (double)count);
+    uint64_t seen = 0;
+    size_t bucket = 0;
+
+    if (count == 0)
+        return 0;
+    if (rank == 0)
+        rank = 1;
+    while (seen + buckets[bucket] < rank)
+        seen += buckets[bucket++];
+    return queueLatencyBucketTop(bucket) < max ? queueLatencyBucketTop(bucket) : max;
+}
+
+static void print_run(bool json, double seconds, uint64_t *buckets, uint64_t max)
+{
+    long total = current.items_per_producer * current.producers;
+    double ops = (double)total / seconds;
+    uint64_t p50 = percentile(buckets, (uint64_t)total, max, 0.5);
+    uint64_t p99 = percentile(buckets, (uint64_t)total, max, 0.99);
+    uint64_t p999 = percentile(buckets, (uint64_t)total, max, 0.999);
+
+    if (json)
+        printf("{\"mode\":\"%s\",\"producers\":%d,\"consumers\":%d,\"batch\":%d,\"pattern\":\"%s\",\"payload\":%zu,"
+               "\"items\":%ld,\"ops_per_sec\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu}\n",
+               mode_names[current.mode], current.producers, current.consumers, current.batch,
+               pattern_names[current.pattern], current.payload, total, ops, (unsigned long long)p50,
+               (unsigned long long)p99, (unsigned long long)p999);
+    else
+        printf("%s,%d,%d,%d,%s,%zu,%ld,%.0f,%llu,%llu,%llu\n", mode_names[current.mode], current.producers,
+               current.consumers, current.batch, pattern_names[current.pattern], current.payload, total, ops,
+               (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999);
+    fflush(stdout);
+}
+
+static void free_pools(void)
+{
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        free(producer_pools[i].pool);
+        producer_pools[i].pool = NULL;
+    }
+}
+
+static bool run(bool json)
+{
+    QueueOptions options = {.mode = current.mode};
+    thrd_t producers[MAX_THREADS];
+    thrd_t consumers[MAX_THREADS];
+    uint64_t buckets[QUEUE_LATENCY_BUCKETS] = {0};
+    uint64_t max = 0;
+    uint64_t start;
+    uint64_t end;
+
+    q = queueCreateWithOptions(&options);
+    if (q == NULL)
+        return false;
+    atomic_store(&consumed, 0);
+    memset(consumer_stats, 0, sizeof(consumer_stats));
+    memset(producer_pools, 0, sizeof(producer_pools));
+    for (int i = 0; i < current.producers && pooled(); i++)
+    {
+        producer_pools[i].pool = aligned_alloc(64, (POOL_ITEMS * item_size() + 63) / 64 * 64);
+        if (producer_pools[i].pool == NULL)
+        {
+            free_pools();
+            queueDestroy(q);
+            return false;
+        }
+        for (size_t item = 0; item < POOL_ITEMS; item++)
+            atomic_init(&((Item *)(producer_pools[i].pool + item * item_size()))->in_flight, false);
+    }
+
+    start = now_ns();
+    for (int i = 0; i < current.consumers; i++)
+        thrd_create(&consumers[i], consume, &consumer_stats[i]);
+    for (int i = 0; i < current.producers; i++)
+        thrd_create(&producers[i], produce, &producer_pools[i]);
+    for (int i = 0; i < current.producers; i++)
+        thrd_join(producers[i], NULL);
+    for (int i = 0; i < current.consumers; i++)
+        thrd_join(consumers[i], NULL);
+    end = now_ns();
+
+    for (int i = 0; i < current.consumers; i++)
+    {
+        for (size_t b = 0; b < QUEUE_LATENCY_BUCKETS; b++)
+            buckets[b] += consumer_stats[i].buckets[b];
+        if (consumer_stats[i].max > max)
+            max = consumer_stats[i].max;
+    }
+    print_run(json, (double)(end - start) / 1e9, buckets, max);
+    queueDestroy(q);
+    free_pools();
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--json] [-n items per producer] [-m mode]\n", name);
+    fprintf(stderr, "modes: locked two_lock lock_free ring sharded spsc intrusive combining multi (default: all)\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const int threads[][2] = {{1, 1}, {2, 2}, {4, 4}, {1, 4}, {4, 1}};
+    static const int batches[] = {1, 32};
+    // payload bytes per item, 0 passes just the enqueue time.
+    static const size_t payloads[] = {0, 64, 1024};
+    long items = DEFAULT_ITEMS;
+    int only_mode = -1;
+    bool json = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            items = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            i++;
+            for (int m = 0; m < (int)(sizeof(mode_names) / sizeof(mode_names[0])); m++)
+            {
+                if (strcmp(argv[i], mode_names[m]) == 0)
+                    only_mode = m;
+            }
+            if (only_mode < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (items <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &bench_start);
+    if (!json)
+        printf("mode,producers,consumers,batch,pattern,payload,items,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+
+    for (int m = 0; m < (int)(sizeof(mode_names) / sizeof(mode_names[0])); m++)
+    {
+        if (only_mode >= 0 && m != only_mode)
+            continue;
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+        {
+            // the spsc ring allows only one thread on each side.
+            if (m == QUEUE_MODE_SPSC && (threads[t][0] != 1 || threads[t][1] != 1))
+            {
+                fprintf(stderr, "skipped %s with %d producer and %d consumer threads: one of each only\n", mode_names[m],
+                        threads[t][0], threads[t][1]);
+                continue;
+            }
+            for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+            {
+                for (int p = PATTERN_STEADY; p <= PATTERN_BURSTY; p++)
+                {
+                    for (size_t s = 0; s < sizeof(payloads) / sizeof(payloads[0]); s++)
+                    {
+                        current = (Run){
+                            .mode = (QueueMode)m,
+                            .producers = threads[t][0],
+                            .consumers = threads[t][1],
+                            .batch = batches[b],
+                            .pattern = (Pattern)p,
+                            .payload = payloads[s],
+                            .items_per_producer = items,
+                        };
+                        if (!run(json))
+                        {
+                            fprintf(stderr, "could not create a %s queue\n", mode_names[m]);
+                            return 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -1,180 +1,4262 @@
+#include <errno.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <threads.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#ifdef SYS_mbind
+#include <linux/mempolicy.h>
+#endif
+#ifdef SYS_membarrier
+#include <linux/membarrier.h>
+#endif
+// unistd.h only declares syscall() with _GNU_SOURCE, which may be too late to define if queue.c is included after it.
+long syscall(long, ...);
+#endif
 #include "queue.h"
 
 /* ### Linked List ###*/
 // We are using a linked list to implement the queue (this way the queue size is not bounded arbitrarily)
+// the default mode links chunks of items (see data queue), the other list based modes link a node per item.
 typedef struct Node
 {
     void *data;
-    struct Node *next;
+    // next is atomic because the two lock and lock free modes read it while a producer links a new node.
+    _Atomic(struct Node *) next;
+    // when data was enqueued, only set with latency stats (see Item Stamps).
+    uint64_t enqueued;
 } Node;
 
 /* ### data queue ### */
-// the data queue is implemented using a linked list.
-// the size and visited fields are atomic to avoid undefined behaviour in case of multithreading.
+// the data queue of the locked mode is an unrolled list: items are stored in chunks of CHUNK_ITEMS pointers,
+// so a long queue costs one pointer per item and dequeueing walks an array instead of chasing a node per item.
+// items are written at items[tail] of the last chunk and read from items[head] of the first one.
+#define CHUNK_BYTES 512
+#define CHUNK_ITEMS ((CHUNK_BYTES - sizeof(void *) - 2 * sizeof(unsigned int)) / sizeof(void *))
+
+typedef struct Chunk
+{
+    _Alignas(64) struct Chunk *next;
+    unsigned int head;
+    unsigned int tail;
+    void *items[CHUNK_ITEMS];
+} Chunk;
+
+// with latency stats every chunk is followed by the enqueue times of its items, CHUNK_STAMPS(chunk)[i] belongs to items[i].
+#define CHUNK_STAMPS(chunk) ((uint64_t *)((chunk) + 1))
+#define STAMPED_CHUNK_BYTES ((sizeof(Chunk) + CHUNK_ITEMS * sizeof(uint64_t) + 63) / 64 * 64)
+
+// drained chunks are kept here for reuse (at most max of them) instead of going back to the system.
+// several queues under the same lock can share one, their chunks are all stamped or none of them is.
+typedef struct ChunkSpares
+{
+    Chunk *free;
+    size_t count;
+    size_t max;
+    bool stamped;
+} ChunkSpares;
+
 typedef struct Queue
 {
-    Node *head;
-    Node *tail;
+    Chunk *head;
+    Chunk *tail;
+    ChunkSpares *spares;
     size_t size;
     size_t visited;
 } Queue;
 
+/* ### Item Stamps ###*/
+// with QueueOptions.latency_stats every mode keeps the enqueue time of an item next to it: in its chunk, its node,
+// a stamps array beside its ring slots, or the waiter record it is handed to. the intrusive and multi modes keep runs of
+// items that share a stamp instead (see Stamp Runs). a dequeue records the sojourn of the items it takes through a recorder,
+// which reads the clock once per dequeue. the histograms themselves are in Latency Stats.
+struct Histogram;
+
+typedef struct SojournRecorder
+{
+    // NULL without latency_stats, or if the thread's histograms could not be allocated.
+    struct Histogram *histogram;
+    uint64_t now;
+} SojournRecorder;
+
+// the enqueue time to store with an item, 0 (without reading the clock) if q has no latency_stats.
+static uint64_t enqueue_stamp(QueueHandle *q);
+static SojournRecorder sojourn_recorder(QueueHandle *q);
+// records count items enqueued at stamp and dequeued at recorder->now.
+static void record_sojourn(const SojournRecorder *recorder, uint64_t stamp, size_t count);
+
 /* ### List Helper Functions ###*/
-void append_item(Node *item, Queue *q)
+static Chunk *new_chunk(Queue *q)
 {
-    q->size++;
+    Chunk *chunk = q->spares->free;
+    if (chunk != NULL)
+    {
+        q->spares->free = chunk->next;
+        q->spares->count--;
+    }
+    else
+    {
+        chunk = (Chunk *)aligned_alloc(_Alignof(Chunk), q->spares->stamped ? STAMPED_CHUNK_BYTES : sizeof(Chunk));
+    }
+    chunk->next = NULL;
+    chunk->head = 0;
+    chunk->tail = 0;
+    return chunk;
+}
 
-    if (q->head == NULL)
+static void recycle_chunk(Queue *q, Chunk *chunk)
+{
+    if (q->spares->count >= q->spares->max)
     {
-        q->head = item;
-        q->tail = item;
+        free(chunk);
         return;
     }
+    chunk->next = q->spares->free;
+    q->spares->free = chunk;
+    q->spares->count++;
+}
+
+// makes sure the last chunk has a free slot.
+static void reserve_slot(Queue *q)
+{
+    Chunk *chunk;
+    if (q->tail != NULL && q->tail->tail < CHUNK_ITEMS)
+        return;
 
-    q->tail->next = item;
-    q->tail = item;
+    chunk = new_chunk(q);
+    if (q->tail == NULL)
+        q->head = chunk;
+    else
+        q->tail->next = chunk;
+    q->tail = chunk;
+}
+
+// stamp is ignored unless the list's chunks are stamped.
+void append_item(void *data, uint64_t stamp, Queue *q)
+{
+    q->size++;
+    reserve_slot(q);
+    if (q->spares->stamped)
+        CHUNK_STAMPS(q->tail)[q->tail->tail] = stamp;
+    q->tail->items[q->tail->tail++] = data;
     return;
 }
 
-void *remove_head(Queue *q)
+// appends count items in order, filling the last chunk before starting new ones.
+static void append_items(void *const *items, size_t count, uint64_t stamp, Queue *q)
 {
-    Node *tmp = q->head;
-    void* data = tmp->data;
-    q->head = tmp->next;
-    free(tmp);
-    if (q->head == NULL)
-        q->tail = NULL;
+    size_t n;
+    q->size += count;
+    while (count > 0)
+    {
+        reserve_slot(q);
+        n = CHUNK_ITEMS - q->tail->tail;
+        if (n > count)
+            n = count;
+        memcpy(&q->tail->items[q->tail->tail], items, n * sizeof(void *));
+        if (q->spares->stamped)
+        {
+            for (size_t i = 0; i < n; i++)
+                CHUNK_STAMPS(q->tail)[q->tail->tail + i] = stamp;
+        }
+        q->tail->tail += n;
+        items += n;
+        count -= n;
+    }
+}
+
+// called once the first chunk is drained. the last chunk is kept (and rewound) so an empty queue does not churn chunks.
+static void drop_head_chunk(Queue *q)
+{
+    Chunk *chunk = q->head;
+    if (chunk == q->tail)
+    {
+        chunk->head = 0;
+        chunk->tail = 0;
+        return;
+    }
+    q->head = chunk->next;
+    recycle_chunk(q, chunk);
+}
+
+// removes and returns the oldest item, the queue must not be empty. recorder may be NULL if the chunks are not stamped.
+void *remove_head(Queue *q, const SojournRecorder *recorder)
+{
+    Chunk *chunk = q->head;
+    void *data;
+    if (q->spares->stamped)
+        record_sojourn(recorder, CHUNK_STAMPS(chunk)[chunk->head], 1);
+    data = chunk->items[chunk->head++];
+    if (chunk->head == chunk->tail)
+        drop_head_chunk(q);
     q->size--;
     q->visited++;
     return data;
 }
 
-void destroy_list(Node *head)
+// copies the oldest count items (count <= q->size) to items and removes them, recorder as for remove_head.
+static void remove_items(Queue *q, void **items, size_t count, const SojournRecorder *recorder)
+{
+    Chunk *chunk;
+    size_t n;
+    q->size -= count;
+    q->visited += count;
+    while (count > 0)
+    {
+        chunk = q->head;
+        n = chunk->tail - chunk->head;
+        if (n > count)
+            n = count;
+        memcpy(items, &chunk->items[chunk->head], n * sizeof(void *));
+        if (q->spares->stamped)
+        {
+            for (size_t i = 0; i < n; i++)
+                record_sojourn(recorder, CHUNK_STAMPS(chunk)[chunk->head + i], 1);
+        }
+        chunk->head += n;
+        items += n;
+        count -= n;
+        if (chunk->head == chunk->tail)
+            drop_head_chunk(q);
+    }
+}
+
+static void init_list(Queue *q, ChunkSpares *spares)
+{
+    q->head = NULL;
+    q->tail = NULL;
+    q->spares = spares;
+    q->size = 0;
+    q->visited = 0;
+}
+
+static void init_spares(ChunkSpares *spares, size_t max, bool stamped)
+{
+    spares->free = NULL;
+    spares->count = 0;
+    spares->max = max;
+    spares->stamped = stamped;
+}
+
+static void free_chunks(Chunk *chunk)
+{
+    Chunk *tmp;
+    while (chunk != NULL)
+    {
+        tmp = chunk;
+        chunk = chunk->next;
+        free(tmp);
+    }
+}
+
+static void destroy_chunks(Queue *q)
+{
+    free_chunks(q->head);
+    q->head = NULL;
+    q->tail = NULL;
+}
+
+static void destroy_spares(ChunkSpares *spares)
+{
+    free_chunks(spares->free);
+    spares->free = NULL;
+    spares->count = 0;
+}
+
+struct NodePool;
+static void release_node(struct NodePool *pool, Node *node);
+
+// nodes go back to pool, or to the system allocator if pool is NULL.
+void destroy_list(Node *head, struct NodePool *pool)
 {
     Node *tmp;
     while (head != NULL)
     {
         tmp = head;
-        head = head->next;
-        free(tmp);
+        head = atomic_load_explicit(&head->next, memory_order_relaxed);
+        if (pool != NULL)
+            release_node(pool, tmp);
+        else
+            free(tmp);
     }
     return;
 }
 
-/* ############## -Code Start- ############## */
+/* ### Node Pool ### */
+// nodes are carved from page sized slabs owned by the queue instead of calling malloc and free for every item.
+// every thread keeps a small cache of free nodes per pool, so a steady stream of enqueue/dequeue does not touch any lock for its nodes.
+// caches are refilled from and flushed to the slabs in batches under the pool lock, and a slab whose nodes are all free
+// is returned to the system while the pool holds more than high_watermark free nodes.
+#define POOL_SLAB_BYTES 4096
+#define POOL_BATCH 32
+#define POOL_CACHE_NODES (2 * POOL_BATCH)
+#define POOL_THREAD_CACHES 4
+#define POOL_DEFAULT_HIGH_WATERMARK 4096
 
-// this is lock for enqueue and dequeue.
-// TODO consider using one queue for enqueue and one for dequeue
-mtx_t queue_lock;
-static Queue *data_queue;
-// please note we used the same structure for read_queue even though its visited value is unused. this means the visited value of read_queue will not be maintained.
-static Queue *read_queue;
+struct NodePool;
 
-void initQueue(void)
+typedef struct NodeSlab
+{
+    struct NodePool *pool;
+    // slabs with at least one free node are on the pool's partial list.
+    struct NodeSlab *prev;
+    struct NodeSlab *next;
+    // every slab is on the pool's slabs list, so destroy can free the ones whose nodes are still in use.
+    struct NodeSlab *prev_slab;
+    struct NodeSlab *next_slab;
+    Node *free;
+    size_t free_count;
+    bool listed;
+    Node nodes[];
+} NodeSlab;
+
+#define POOL_SLAB_NODES ((POOL_SLAB_BYTES - sizeof(NodeSlab)) / sizeof(Node))
+
+typedef struct NodePool
 {
-    data_queue = (Queue *)malloc(sizeof(Queue));
-    read_queue = (Queue *)malloc(sizeof(Queue));
-    // Initialize queues values.
-    data_queue->head = NULL;
-    data_queue->tail = NULL;
-    data_queue->size = 0;
-    data_queue->visited = 0;
-    read_queue->head = NULL;
-    read_queue->tail = NULL;
-    read_queue->size = 0;
-    read_queue->visited = 0;
-    mtx_init(&queue_lock, mtx_plain);
+    mtx_t lock;
+    NodeSlab *partial;
+    NodeSlab *slabs;
+    // free nodes held by the slabs, nodes sitting in thread caches are not counted.
+    size_t free_nodes;
+    size_t high_watermark;
+    // a destroyed pool may be followed by a new one at the same address, thread caches compare the id as well.
+    size_t id;
+    struct NodePool *next_live;
+} NodePool;
+
+typedef struct NodeCache
+{
+    NodePool *pool;
+    size_t pool_id;
+    Node *free;
+    size_t count;
+} NodeCache;
+
+static _Thread_local NodeCache node_caches[POOL_THREAD_CACHES];
+static _Thread_local unsigned next_evicted_cache;
+
+// live pools are registered so a thread that exits can tell whether the pools it still caches nodes for exist.
+static mtx_t pool_registry_lock;
+static NodePool *live_pools;
+static size_t next_pool_id = 1;
+static tss_t pool_cache_key;
+static once_flag pool_once = ONCE_FLAG_INIT;
+
+static NodeSlab *slab_of(Node *node)
+{
+    return (NodeSlab *)((uintptr_t)node & ~(uintptr_t)(POOL_SLAB_BYTES - 1));
 }
 
-void destroyQueue(void)
+// must be called with pool->lock held.
+static void unlist_slab(NodePool *pool, NodeSlab *slab)
 {
-    destroy_list(data_queue->head);
-    destroy_list(read_queue->head);
-    free(data_queue);
-    free(read_queue);
-    mtx_destroy(&queue_lock);
-    return;
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        pool->partial = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+    slab->listed = false;
 }
 
-void enqueue(void *data)
+// must be called with pool->lock held.
+static void list_slab(NodePool *pool, NodeSlab *slab)
 {
-    // write data to queue, increase data_queue->size by one.
-    Node *tmp = (Node *)malloc(sizeof(Node));
-    tmp->data = data;
-    tmp->next = NULL;
+    slab->prev = NULL;
+    slab->next = pool->partial;
+    if (pool->partial != NULL)
+        pool->partial->prev = slab;
+    pool->partial = slab;
+    slab->listed = true;
+}
 
-    // aquire lock.
-    mtx_lock(&queue_lock);
-    append_item(tmp, data_queue);
+// must be called with pool->lock held.
+static NodeSlab *new_slab(NodePool *pool)
+{
+    NodeSlab *slab = (NodeSlab *)aligned_alloc(POOL_SLAB_BYTES, POOL_SLAB_BYTES);
+    if (slab == NULL)
+        return NULL;
 
-    // awake the oldest member of read_queue (if there is one).
-    if (read_queue->size > 0)
+    slab->pool = pool;
+    slab->free = NULL;
+    for (size_t i = POOL_SLAB_NODES; i > 0; i--)
     {
-        cnd_signal(read_queue->head->data);
-        remove_head(read_queue);
+        atomic_init(&slab->nodes[i - 1].next, slab->free);
+        slab->free = &slab->nodes[i - 1];
     }
+    slab->free_count = POOL_SLAB_NODES;
+    pool->free_nodes += POOL_SLAB_NODES;
+    list_slab(pool, slab);
 
-    // release lock.
-    mtx_unlock(&queue_lock);
-    return;
+    slab->prev_slab = NULL;
+    slab->next_slab = pool->slabs;
+    if (pool->slabs != NULL)
+        pool->slabs->prev_slab = slab;
+    pool->slabs = slab;
+    return slab;
 }
 
-void *dequeue(void)
+// gives count nodes linked through next back to their slabs. must be called with pool->lock held.
+static void return_nodes(NodePool *pool, Node *list, size_t count)
 {
-    Node *tmp;
-    void *data;
+    Node *node;
+    NodeSlab *slab;
 
-    // aquire lock.
-    mtx_lock(&queue_lock);
+    while (count-- > 0)
+    {
+        node = list;
+        list = atomic_load_explicit(&node->next, memory_order_relaxed);
+        slab = slab_of(node);
+        atomic_store_explicit(&node->next, slab->free, memory_order_relaxed);
+        slab->free = node;
+        slab->free_count++;
+        pool->free_nodes++;
+        if (!slab->listed)
+            list_slab(pool, slab);
+
+        if (slab->free_count == POOL_SLAB_NODES && pool->free_nodes >= pool->high_watermark + POOL_SLAB_NODES)
+        {
+            unlist_slab(pool, slab);
+            if (slab->prev_slab != NULL)
+                slab->prev_slab->next_slab = slab->next_slab;
+            else
+                pool->slabs = slab->next_slab;
+            if (slab->next_slab != NULL)
+                slab->next_slab->prev_slab = slab->prev_slab;
+            pool->free_nodes -= POOL_SLAB_NODES;
+            free(slab);
+        }
+    }
+}
 
-    if (data_queue->size == 0 || read_queue->size > 0)
+static void flush_cache(NodeCache *cache, size_t count)
+{
+    Node *list = cache->free;
+    Node *last = list;
+    for (size_t i = 1; i < count; i++)
+        last = atomic_load_explicit(&last->next, memory_order_relaxed);
+    cache->free = atomic_load_explicit(&last->next, memory_order_relaxed);
+    cache->count -= count;
+
+    mtx_lock(&cache->pool->lock);
+    return_nodes(cache->pool, list, count);
+    mtx_unlock(&cache->pool->lock);
+}
+
+// empties a cache slot whose pool may already be destroyed, its nodes are only returned if the pool is still registered.
+static void drop_cache(NodeCache *cache)
+{
+    mtx_lock(&pool_registry_lock);
+    for (NodePool *pool = live_pools; pool != NULL; pool = pool->next_live)
     {
-        tmp = (Node *)malloc(sizeof(Node));
-        tmp->next = NULL;
-        tmp->data = (cnd_t *)malloc(sizeof(cnd_t));
-        append_item(tmp, read_queue);
-        cnd_init(tmp->data);
-        cnd_wait(tmp->data, &queue_lock);
+        if (pool == cache->pool && pool->id == cache->pool_id)
+        {
+            if (cache->count > 0)
+                flush_cache(cache, cache->count);
+            break;
+        }
     }
-    // Note: we assume there can not be spurios wake ups of threads. in general we should add here a while loop to make sure there are items to deque. (it would be wise to add it either way to save us in case of bugs).
+    mtx_unlock(&pool_registry_lock);
+    cache->pool = NULL;
+    cache->free = NULL;
+    cache->count = 0;
+}
 
-    data = remove_head(data_queue);
-    mtx_unlock(&queue_lock);
-    return data;
+static void release_node_caches(void *unused)
+{
+    (void)unused;
+    for (int i = 0; i < POOL_THREAD_CACHES; i++)
+    {
+        if (node_caches[i].pool != NULL)
+            drop_cache(&node_caches[i]);
+    }
 }
 
-bool tryDequeue(void **item)
+static void init_pool_registry(void)
 {
-    if (data_queue->size == 0)
+    mtx_init(&pool_registry_lock, mtx_plain);
+    tss_create(&pool_cache_key, release_node_caches);
+}
+
+static NodeCache *node_cache(NodePool *pool)
+{
+    NodeCache *cache;
+    NodeCache *empty = NULL;
+
+    for (int i = 0; i < POOL_THREAD_CACHES; i++)
     {
+        cache = &node_caches[i];
+        if (cache->pool == pool && cache->pool_id == pool->id)
+            return cache;
+        if (cache->pool == pool)
+        {
+            // left over from a destroyed pool at the same address, its nodes are gone.
+            cache->pool = NULL;
+            cache->free = NULL;
+            cache->count = 0;
+        }
+        if (cache->pool == NULL && empty == NULL)
+            empty = cache;
+    }
+
+    if (empty == NULL)
+    {
+        empty = &node_caches[next_evicted_cache++ % POOL_THREAD_CACHES];
+        drop_cache(empty);
+    }
+    // makes sure release_node_caches runs when this thread exits.
+    tss_set(pool_cache_key, node_caches);
+    empty->pool = pool;
+    empty->pool_id = pool->id;
+    return empty;
+}
+
+static bool init_pool(NodePool *pool, size_t high_watermark)
+{
+    call_once(&pool_once, init_pool_registry);
+    if (mtx_init(&pool->lock, mtx_plain) != thrd_success)
         return false;
+    pool->partial = NULL;
+    pool->slabs = NULL;
+    pool->free_nodes = 0;
+    pool->high_watermark = high_watermark == 0 ? POOL_DEFAULT_HIGH_WATERMARK : high_watermark;
+
+    mtx_lock(&pool_registry_lock);
+    pool->id = next_pool_id++;
+    pool->next_live = live_pools;
+    live_pools = pool;
+    mtx_unlock(&pool_registry_lock);
+    return true;
+}
+
+// frees every slab, including the nodes still linked in the queue or cached by other threads.
+static void destroy_pool(NodePool *pool)
+{
+    NodeSlab *slab;
+    NodeSlab *next;
+
+    mtx_lock(&pool_registry_lock);
+    for (NodePool **link = &live_pools; *link != NULL; link = &(*link)->next_live)
+    {
+        if (*link == pool)
+        {
+            *link = pool->next_live;
+            break;
+        }
     }
+    mtx_unlock(&pool_registry_lock);
 
-    // aquire lock.
-    mtx_lock(&queue_lock);
+    // the calling thread's cache can be dropped right away, other threads notice the changed id.
+    for (int i = 0; i < POOL_THREAD_CACHES; i++)
+    {
+        if (node_caches[i].pool == pool)
+        {
+            node_caches[i].pool = NULL;
+            node_caches[i].free = NULL;
+            node_caches[i].count = 0;
+        }
+    }
+
+    for (slab = pool->slabs; slab != NULL; slab = next)
+    {
+        next = slab->next_slab;
+        free(slab);
+    }
+    mtx_destroy(&pool->lock);
+}
+
+static Node *alloc_node(NodePool *pool)
+{
+    NodeCache *cache = node_cache(pool);
+    NodeSlab *slab;
+    Node *node;
+
+    if (cache->count == 0)
+    {
+        // refill a batch at once so the pool lock is taken once every POOL_BATCH allocations.
+        mtx_lock(&pool->lock);
+        while (cache->count < POOL_BATCH)
+        {
+            slab = pool->partial != NULL ? pool->partial : new_slab(pool);
+            if (slab == NULL)
+                break;
+            node = slab->free;
+            slab->free = atomic_load_explicit(&node->next, memory_order_relaxed);
+            slab->free_count--;
+            pool->free_nodes--;
+            if (slab->free_count == 0)
+                unlist_slab(pool, slab);
+            atomic_store_explicit(&node->next, cache->free, memory_order_relaxed);
+            cache->free = node;
+            cache->count++;
+        }
+        mtx_unlock(&pool->lock);
+        if (cache->count == 0)
+            return NULL;
+    }
+
+    node = cache->free;
+    cache->free = atomic_load_explicit(&node->next, memory_order_relaxed);
+    cache->count--;
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    return node;
+}
+
+static void release_node(NodePool *pool, Node *node)
+{
+    NodeCache *cache = node_cache(pool);
+
+    atomic_store_explicit(&node->next, cache->free, memory_order_relaxed);
+    cache->free = node;
+    cache->count++;
+    // consumers release what producers allocate, so caches overflow on one side and are refilled on the other.
+    if (cache->count > POOL_CACHE_NODES)
+        flush_cache(cache, POOL_BATCH);
+}
 
-    *item = remove_head(data_queue);
+// allocates a node for every item and links them in order, returns the first node and sets *last.
+static Node *alloc_chain(NodePool *pool, void *const *items, size_t count, uint64_t stamp, Node **last)
+{
+    Node *first = NULL;
+    Node *tmp;
+
+    for (size_t i = count; i > 0; i--)
+    {
+        tmp = alloc_node(pool);
+        tmp->data = items[i - 1];
+        tmp->enqueued = stamp;
+        atomic_store_explicit(&tmp->next, first, memory_order_relaxed);
+        if (first == NULL)
+            *last = tmp;
+        first = tmp;
+    }
+    return first;
+}
+
+// releases count nodes linked through next, storing their data in items when items is not NULL.
+static void release_chain(NodePool *pool, Node *first, size_t count, void **items)
+{
+    Node *tmp;
+    for (size_t i = 0; i < count; i++)
+    {
+        tmp = first;
+        first = atomic_load_explicit(&tmp->next, memory_order_relaxed);
+        if (items != NULL)
+            items[i] = tmp->data;
+        release_node(pool, tmp);
+    }
+}
 
-    mtx_unlock(&queue_lock);
+/* ### Futex ### */
+// blocked threads sleep in the kernel on a 32 bit word and are woken by whoever changes it.
+// other systems get the same interface from a table of mutex/condition pairs, see below.
+#ifdef __linux__
+static void futex_wait(atomic_uint *word, unsigned int expected)
+{
+    // returns right away if *word no longer holds expected, so a wake up between our check and the call is not lost.
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+// like futex_wait, but gives up at deadline (an absolute TIME_UTC time, NULL waits forever) and returns false then.
+static bool futex_wait_until(atomic_uint *word, unsigned int expected, const struct timespec *deadline)
+{
+    if (deadline == NULL)
+    {
+        futex_wait(word, expected);
+        return true;
+    }
+    // the bitset variant takes an absolute timeout, and CLOCK_REALTIME is the clock behind TIME_UTC.
+    if (syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, expected, deadline, NULL,
+                FUTEX_BITSET_MATCH_ANY) == -1 &&
+        (errno == ETIMEDOUT || errno == EINVAL))
+        return false;
     return true;
 }
 
-size_t size(void)
+static void futex_wake(atomic_uint *word, int count)
 {
-    return data_queue->size;
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
 }
-size_t waiting(void)
+#else
+// every word hashes to one of FUTEX_BUCKETS mutex/condition pairs. a waiter checks the word under the bucket lock and
+// a waker broadcasts under it after changing the word, so no wake up is lost, waiters woken for other words just retry.
+#define FUTEX_BUCKETS 64 // the bucket index is the top 6 bits of a 64 bit hash
+
+typedef struct FutexBucket
+{
+    mtx_t lock;
+    cnd_t cond;
+} FutexBucket;
+
+static FutexBucket futex_buckets[FUTEX_BUCKETS];
+static once_flag futex_once = ONCE_FLAG_INIT;
+
+static void init_futex_buckets(void)
 {
-    return read_queue->size;
+    for (int i = 0; i < FUTEX_BUCKETS; i++)
+    {
+        mtx_init(&futex_buckets[i].lock, mtx_plain);
+        cnd_init(&futex_buckets[i].cond);
+    }
 }
-size_t visited(void)
+
+static FutexBucket *futex_bucket(atomic_uint *word)
+{
+    call_once(&futex_once, init_futex_buckets);
+    // hashes all address bits, the waiter records of different threads come from per thread malloc arenas
+    // and often share their low bits.
+    return &futex_buckets[(uint64_t)(uintptr_t)word * 0x9e3779b97f4a7c15u >> 58];
+}
+
+static bool futex_wait_until(atomic_uint *word, unsigned int expected, const struct timespec *deadline)
+{
+    FutexBucket *bucket = futex_bucket(word);
+    bool woken = true;
+
+    mtx_lock(&bucket->lock);
+    if (atomic_load(word) == expected)
+    {
+        if (deadline == NULL)
+            cnd_wait(&bucket->cond, &bucket->lock);
+        else
+            woken = cnd_timedwait(&bucket->cond, &bucket->lock, deadline) != thrd_timedout;
+    }
+    mtx_unlock(&bucket->lock);
+    return woken;
+}
+
+static void futex_wake(atomic_uint *word, int count)
+{
+    FutexBucket *bucket = futex_bucket(word);
+    (void)count;
+    mtx_lock(&bucket->lock);
+    cnd_broadcast(&bucket->cond);
+    mtx_unlock(&bucket->lock);
+}
+#endif
+
+// for busy waiting loops, tells the cpu we are spinning.
+static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+/* ### Counters ### */
+// size, waiting and visited are read by monitoring threads without taking any lock, so they are atomics, and every mode
+// keeps them on a cache line of their own so those reads do not bounce the lines of head and tail.
+// a counter that is only ever written under one lock needs no read-modify-write, a relaxed load and store will do.
+static void counter_add(atomic_size_t *counter, size_t n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void counter_sub(atomic_size_t *counter, size_t n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) - n, memory_order_relaxed);
+}
+
+static size_t counter_get(atomic_size_t *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* ### Waiters ### */
+// a thread blocked in dequeue is represented by its waiter record, which the read queue links through directly.
+// every thread has exactly one record (it can only block in one queue at a time), taken on its first blocking dequeue.
+// enqueue hands its item straight into the record of the first waiter and wakes it through the state futex,
+// so the woken consumer returns without taking the queue lock again and nobody can take its item first.
+// the first waiter is the oldest one (FIFO), or with the LIFO wake policy the one that parked last, whose cache is
+// still warm, while the others stay asleep long enough to be descheduled.
+#define WAITER_PARKED 0
+#define WAITER_HANDED 1
+
+typedef struct Waiter
+{
+    atomic_uint state;
+    void *data;
+    // when data was enqueued, only set with latency stats.
+    uint64_t enqueued;
+    struct Waiter *next;
+} Waiter;
+
+typedef struct WaiterList
+{
+    Waiter *head;
+    Waiter *tail;
+    // new waiters go to the front instead of the back.
+    bool lifo;
+    // written under the lock protecting the list, read by waiting() without it.
+    atomic_size_t size;
+} WaiterList;
+
+// a producer may still call futex_wake on a record after its consumer returned (and even exited),
+// so records of exited threads are kept on a free list for new threads instead of being freed.
+static mtx_t waiter_free_lock;
+static Waiter *free_waiters;
+static tss_t waiter_key;
+static once_flag waiter_once = ONCE_FLAG_INIT;
+
+static void recycle_waiter(void *record)
+{
+    Waiter *w = (Waiter *)record;
+    mtx_lock(&waiter_free_lock);
+    w->next = free_waiters;
+    free_waiters = w;
+    mtx_unlock(&waiter_free_lock);
+}
+
+static void init_waiter_key(void)
+{
+    mtx_init(&waiter_free_lock, mtx_plain);
+    tss_create(&waiter_key, recycle_waiter);
+}
+
+static Waiter *local_waiter(void)
+{
+    Waiter *w;
+
+    call_once(&waiter_once, init_waiter_key);
+    w = tss_get(waiter_key);
+    if (w == NULL)
+    {
+        mtx_lock(&waiter_free_lock);
+        w = free_waiters;
+        if (w != NULL)
+            free_waiters = w->next;
+        mtx_unlock(&waiter_free_lock);
+        if (w == NULL)
+            w = (Waiter *)malloc(sizeof(Waiter));
+        tss_set(waiter_key, w);
+    }
+    atomic_store_explicit(&w->state, WAITER_PARKED, memory_order_relaxed);
+    w->data = NULL;
+    w->next = NULL;
+    return w;
+}
+
+static void init_waiters(WaiterList *list, const QueueOptions *options)
+{
+    list->head = NULL;
+    list->tail = NULL;
+    list->lifo = options->wake_policy == QUEUE_WAKE_LIFO;
+    atomic_init(&list->size, 0);
+}
+
+static void append_waiter(Waiter *w, WaiterList *list)
+{
+    counter_add(&list->size, 1);
+    if (list->lifo)
+    {
+        w->next = list->head;
+        list->head = w;
+        if (list->tail == NULL)
+            list->tail = w;
+        return;
+    }
+    if (list->head == NULL)
+        list->head = w;
+    else
+        list->tail->next = w;
+    list->tail = w;
+}
+
+// removes the first waiter, must be called with the lock protecting list held.
+static Waiter *remove_waiter(WaiterList *list)
+{
+    Waiter *w = list->head;
+    list->head = w->next;
+    if (list->head == NULL)
+        list->tail = NULL;
+    counter_sub(&list->size, 1);
+    return w;
+}
+
+// removes up to count waiters (in list order) and returns them linked through next, how many is stored in *removed.
+static Waiter *remove_waiters(WaiterList *list, size_t count, size_t *removed)
+{
+    Waiter *first = list->head;
+    Waiter *last = NULL;
+    size_t n = 0;
+
+    while (n < count && list->head != NULL)
+    {
+        last = list->head;
+        list->head = last->next;
+        n++;
+    }
+    if (last != NULL)
+        last->next = NULL;
+    if (list->head == NULL)
+        list->tail = NULL;
+    counter_sub(&list->size, n);
+    *removed = n;
+    return n > 0 ? first : NULL;
+}
+
+// removes w if it is still on list, returns false if an enqueue already took it off (and is about to hand over).
+static bool unlink_waiter(WaiterList *list, Waiter *w)
+{
+    Waiter *prev = NULL;
+    for (Waiter *it = list->head; it != NULL; prev = it, it = it->next)
+    {
+        if (it != w)
+            continue;
+        if (prev == NULL)
+            list->head = w->next;
+        else
+            prev->next = w->next;
+        if (list->tail == w)
+            list->tail = prev;
+        counter_sub(&list->size, 1);
+        return true;
+    }
+    return false;
+}
+
+// gives data to a waiter removed from its list, done after the queue lock is released.
+static void hand_over(Waiter *w, void *data, uint64_t stamp)
+{
+    w->data = data;
+    w->enqueued = stamp;
+    atomic_store_explicit(&w->state, WAITER_HANDED, memory_order_release);
+    futex_wake(&w->state, 1);
+}
+
+// sleeps until hand_over, the caller must already be on a waiter list of q and must not hold its lock.
+// returns false once deadline passed, the caller then has to unlink_waiter (or wait for the item if that fails).
+static bool wait_for_item_until(QueueHandle *q, Waiter *w, void **item, const struct timespec *deadline)
+{
+    SojournRecorder recorder;
+    while (atomic_load_explicit(&w->state, memory_order_acquire) == WAITER_PARKED)
+    {
+        if (!futex_wait_until(&w->state, WAITER_PARKED, deadline))
+            return false;
+    }
+    *item = w->data;
+    recorder = sojourn_recorder(q);
+    record_sojourn(&recorder, w->enqueued, 1);
+    return true;
+}
+
+static void *wait_for_item(QueueHandle *q, Waiter *w)
+{
+    void *data;
+    wait_for_item_until(q, w, &data, NULL);
+    return data;
+}
+
+/* ### Lock Profiling ### */
+// compiled in with -DQUEUE_PROFILE_LOCKS only. counts acquisitions of the locked mode's queue_lock per operation,
+// how many of them found it taken (trylock failed first), how long they waited for it and how long they held it,
+// plus how often a dequeue parked and an enqueue woke a parked consumer. without the flag none of this exists.
+#ifdef QUEUE_PROFILE_LOCKS
+enum
 {
-    return data_queue->visited;
-}
\ No newline at end of file
+    LOCK_OP_ENQUEUE,
+    LOCK_OP_DEQUEUE,
+    LOCK_OP_TRY_DEQUEUE,
+    LOCK_OPS
+};
+
+typedef struct LockCounters
+{
+    atomic_size_t acquisitions;
+    atomic_size_t contended;
+    atomic_size_t wait_ns;
+    atomic_size_t hold_ns;
+} LockCounters;
+
+typedef struct LockProfile
+{
+    LockCounters ops[LOCK_OPS];
+    atomic_size_t parks;
+    atomic_size_t wakes;
+    // written by the lock holder only.
+    uint64_t acquired_at;
+} LockProfile;
+
+static void init_lock_profile(LockProfile *profile)
+{
+    for (int i = 0; i < LOCK_OPS; i++)
+    {
+        atomic_init(&profile->ops[i].acquisitions, 0);
+        atomic_init(&profile->ops[i].contended, 0);
+        atomic_init(&profile->ops[i].wait_ns, 0);
+        atomic_init(&profile->ops[i].hold_ns, 0);
+    }
+    atomic_init(&profile->parks, 0);
+    atomic_init(&profile->wakes, 0);
+    profile->acquired_at = 0;
+}
+
+static void profiled_lock(mtx_t *lock, LockProfile *profile, int op)
+{
+    LockCounters *counters = &profile->ops[op];
+    uint64_t start;
+
+    if (mtx_trylock(lock) == thrd_success)
+    {
+        profile->acquired_at = monotonic_ns();
+    }
+    else
+    {
+        start = monotonic_ns();
+        mtx_lock(lock);
+        profile->acquired_at = monotonic_ns();
+        atomic_fetch_add_explicit(&counters->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->wait_ns, profile->acquired_at - start, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&counters->acquisitions, 1, memory_order_relaxed);
+}
+
+static void profiled_unlock(mtx_t *lock, LockProfile *profile, int op)
+{
+    uint64_t held = monotonic_ns() - profile->acquired_at;
+    mtx_unlock(lock);
+    atomic_fetch_add_explicit(&profile->ops[op].hold_ns, held, memory_order_relaxed);
+}
+
+static void read_lock_counters(LockCounters *counters, QueueLockOpStats *out)
+{
+    out->acquisitions = counter_get(&counters->acquisitions);
+    out->contended = counter_get(&counters->contended);
+    out->wait_ns = counter_get(&counters->wait_ns);
+    out->hold_ns = counter_get(&counters->hold_ns);
+}
+
+static void read_lock_profile(LockProfile *profile, QueueLockStats *out)
+{
+    read_lock_counters(&profile->ops[LOCK_OP_ENQUEUE], &out->enqueue);
+    read_lock_counters(&profile->ops[LOCK_OP_DEQUEUE], &out->dequeue);
+    read_lock_counters(&profile->ops[LOCK_OP_TRY_DEQUEUE], &out->try_dequeue);
+    out->parks = counter_get(&profile->parks);
+    out->wakes = counter_get(&profile->wakes);
+}
+#endif
+
+/* ### Queue Handle ### */
+// every queue instance is a handle whose ops table implements the selected mode.
+// each mode embeds QueueHandle as its first member, so a handle can be cast to the mode's own structure.
+typedef struct QueueOps
+{
+    void (*enqueue)(QueueHandle *, void *);
+    // NULL for unbounded modes, where an enqueue can not fail.
+    bool (*try_enqueue)(QueueHandle *, void *);
+    // NULL if the mode has nothing better than enqueueing the items one by one.
+    void (*enqueue_many)(QueueHandle *, void *const *, size_t);
+    // NULL for modes without priority lanes, they enqueue every item alike.
+    void (*enqueue_priority)(QueueHandle *, void *, unsigned int);
+    void *(*dequeue)(QueueHandle *);
+    bool (*try_dequeue)(QueueHandle *, void **);
+    // blocks like dequeue, but gives up and returns false once the deadline passed.
+    bool (*dequeue_timeout)(QueueHandle *, void **, const struct timespec *);
+    // NULL if the mode has nothing better than dequeueing the items one by one.
+    size_t (*try_dequeue_many)(QueueHandle *, void **, size_t);
+    size_t (*size)(QueueHandle *);
+    size_t (*waiting)(QueueHandle *);
+    size_t (*visited)(QueueHandle *);
+    void (*destroy)(QueueHandle *);
+    // NULL for modes without lock profiling, and always without QUEUE_PROFILE_LOCKS.
+    void (*lock_stats)(QueueHandle *, QueueLockStats *);
+} QueueOps;
+
+struct QueueHandle
+{
+    const QueueOps *ops;
+    QueueMode mode;
+    // NULL unless the queue was created with latency_stats.
+    struct LatencyStats *stats;
+    // -1 unless the queue was created with event_fd, see Readiness Fd.
+    int event_fd;
+    atomic_bool event_armed;
+    // see Adaptive Spinning, on a line of their own: ops is read by every call and the modes keep their hot fields right
+    // behind the handle, while these are only written around a consumer's wait.
+    // when the last consumer started waiting (in ns), 0 once an enqueue took it as a sample.
+    _Alignas(64) _Atomic uint64_t wait_start;
+    // moving average of the time from a consumer starting to wait to the next item (in ns).
+    atomic_uint arrival_estimate;
+};
+
+/* ### Locked Queue ### */
+// the default mode: a single lock protects both the data queue and the read queue.
+// the data queue is split into QUEUE_PRIORITY_LANES lanes, each its own FIFO, and dequeue always serves the highest
+// non-empty lane. plain enqueues go to lane 0, so without enqueuePriority this is one FIFO.
+typedef struct LockedQueue
+{
+    QueueHandle base;
+    // this is lock for enqueue and dequeue.
+    mtx_t queue_lock;
+    Queue lanes[QUEUE_PRIORITY_LANES];
+    // bit i is set while lanes[i] holds items, so the highest lane is found without looking at the empty ones.
+    unsigned int nonempty;
+    ChunkSpares spares;
+    // threads blocked in dequeue, in wake order (see Waiters).
+    WaiterList read_queue;
+    // items in all lanes, and items dequeued or handed over. written under queue_lock.
+    _Alignas(64) atomic_size_t size;
+    atomic_size_t visited;
+#ifdef QUEUE_PROFILE_LOCKS
+    LockProfile profile;
+#endif
+} LockedQueue;
+
+#ifdef QUEUE_PROFILE_LOCKS
+#define LOCK_QUEUE(q, op) profiled_lock(&(q)->queue_lock, &(q)->profile, op)
+#define UNLOCK_QUEUE(q, op) profiled_unlock(&(q)->queue_lock, &(q)->profile, op)
+#define PROFILE_COUNT(q, counter, n) atomic_fetch_add_explicit(&(q)->profile.counter, n, memory_order_relaxed)
+#else
+#define LOCK_QUEUE(q, op) mtx_lock(&(q)->queue_lock)
+#define UNLOCK_QUEUE(q, op) mtx_unlock(&(q)->queue_lock)
+#define PROFILE_COUNT(q, counter, n) ((void)0)
+#endif
+
+// must be called with queue_lock held and at least one item queued.
+static unsigned int highest_lane(LockedQueue *q)
+{
+    return (unsigned int)(sizeof(unsigned int) * 8 - 1 - __builtin_clz(q->nonempty));
+}
+
+static void *pop_item(LockedQueue *q, const SojournRecorder *recorder)
+{
+    unsigned int lane = highest_lane(q);
+    void *data = remove_head(&q->lanes[lane], recorder);
+    if (q->lanes[lane].size == 0)
+        q->nonempty &= ~(1u << lane);
+    counter_sub(&q->size, 1);
+    counter_add(&q->visited, 1);
+    return data;
+}
+
+// takes up to max items, highest lane first, must be called with queue_lock held.
+static size_t pop_items(LockedQueue *q, void **items, size_t max, const SojournRecorder *recorder)
+{
+    unsigned int lane;
+    size_t count = 0;
+    size_t n;
+
+    while (count < max && q->nonempty != 0)
+    {
+        lane = highest_lane(q);
+        n = q->lanes[lane].size < max - count ? q->lanes[lane].size : max - count;
+        remove_items(&q->lanes[lane], items + count, n, recorder);
+        if (q->lanes[lane].size == 0)
+            q->nonempty &= ~(1u << lane);
+        count += n;
+    }
+    counter_sub(&q->size, count);
+    counter_add(&q->visited, count);
+    return count;
+}
+
+static void locked_enqueue_priority(QueueHandle *handle, void *data, unsigned int priority)
+{
+    LockedQueue *q = (LockedQueue *)handle;
+    uint64_t stamp = enqueue_stamp(handle);
+    Waiter *w;
+
+    // aquire lock.
+    LOCK_QUEUE(q, LOCK_OP_ENQUEUE);
+
+    // the first member of read_queue (if there is one) gets the item directly, it never enters the data queue.
+    // waiters only exist while every lane is empty, so this is the highest priority item anyway.
+    if (counter_get(&q->read_queue.size) > 0)
+    {
+        w = remove_waiter(&q->read_queue);
+        counter_add(&q->visited, 1);
+        UNLOCK_QUEUE(q, LOCK_OP_ENQUEUE);
+        PROFILE_COUNT(q, wakes, 1);
+        hand_over(w, data, stamp);
+        return;
+    }
+
+    // write data to its lane, increase size by one.
+    append_item(data, stamp, &q->lanes[priority]);
+    q->nonempty |= 1u << priority;
+    counter_add(&q->size, 1);
+
+    // release lock.
+    UNLOCK_QUEUE(q, LOCK_OP_ENQUEUE);
+    return;
+}
+
+static void locked_enqueue(QueueHandle *handle, void *data)
+{
+    locked_enqueue_priority(handle, data, 0);
+}
+
+static void locked_enqueue_many(QueueHandle *handle, void *const *items, size_t count)
+{
+    LockedQueue *q = (LockedQueue *)handle;
+    uint64_t stamp;
+    Waiter *waiters;
+    Waiter *w;
+    size_t handed;
+
+    if (count == 0)
+        return;
+
+    stamp = enqueue_stamp(handle);
+    LOCK_QUEUE(q, LOCK_OP_ENQUEUE);
+    // the first items go to the waiters in order, the rest is copied into lane 0 at once.
+    waiters = remove_waiters(&q->read_queue, count, &handed);
+    counter_add(&q->visited, handed);
+    if (handed < count)
+    {
+        append_items(items + handed, count - handed, stamp, &q->lanes[0]);
+        q->nonempty |= 1u;
+        counter_add(&q->size, count - handed);
+    }
+    UNLOCK_QUEUE(q, LOCK_OP_ENQUEUE);
+    PROFILE_COUNT(q, wakes, handed);
+
+    for (size_t i = 0; i < handed; i++)
+    {
+        // next of a waiter is not touched once it was handed over, so read it first.
+        w = waiters;
+        waiters = w->next;
+        hand_over(w, items[i], stamp);
+    }
+}
+
+static bool locked_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    LockedQueue *q = (LockedQueue *)handle;
+    SojournRecorder recorder;
+    Waiter *w;
+    bool removed;
+
+    // aquire lock.
+    LOCK_QUEUE(q, LOCK_OP_DEQUEUE);
+
+    // enqueue never leaves items in the data queue while there are waiters, so an empty data queue is all we need to check.
+    if (counter_get(&q->size) == 0)
+    {
+        w = local_waiter();
+        append_waiter(w, &q->read_queue);
+        UNLOCK_QUEUE(q, LOCK_OP_DEQUEUE);
+        PROFILE_COUNT(q, parks, 1);
+        if (wait_for_item_until(handle, w, item, deadline))
+            return true;
+
+        // timed out, unless an enqueue took us off read_queue in the meantime and its item is on the way.
+        LOCK_QUEUE(q, LOCK_OP_DEQUEUE);
+        removed = unlink_waiter(&q->read_queue, w);
+        UNLOCK_QUEUE(q, LOCK_OP_DEQUEUE);
+        if (removed)
+            return false;
+        *item = wait_for_item(handle, w);
+        return true;
+    }
+
+    recorder = sojourn_recorder(handle);
+    *item = pop_item(q, &recorder);
+    UNLOCK_QUEUE(q, LOCK_OP_DEQUEUE);
+    return true;
+}
+
+static void *locked_dequeue(QueueHandle *handle)
+{
+    void *data;
+    locked_dequeue_timeout(handle, &data, NULL);
+    return data;
+}
+
+static bool locked_try_dequeue(QueueHandle *handle, void **item)
+{
+    LockedQueue *q = (LockedQueue *)handle;
+    SojournRecorder recorder;
+
+    if (counter_get(&q->size) == 0)
+    {
+        return false;
+    }
+
+    // aquire lock.
+    LOCK_QUEUE(q, LOCK_OP_TRY_DEQUEUE);
+
+    // another consumer may have taken the item since we looked.
+    if (counter_get(&q->size) == 0)
+    {
+        UNLOCK_QUEUE(q, LOCK_OP_TRY_DEQUEUE);
+        return false;
+    }
+    recorder = sojourn_recorder(handle);
+    *item = pop_item(q, &recorder);
+
+    UNLOCK_QUEUE(q, LOCK_OP_TRY_DEQUEUE);
+    return true;
+}
+
+static size_t locked_try_dequeue_many(QueueHandle *handle, void **items, size_t max)
+{
+    LockedQueue *q = (LockedQueue *)handle;
+    SojournRecorder recorder;
+    size_t count;
+
+    LOCK_QUEUE(q, LOCK_OP_TRY_DEQUEUE);
+    recorder = sojourn_recorder(handle);
+    count = pop_items(q, items, max, &recorder);
+    UNLOCK_QUEUE(q, LOCK_OP_TRY_DEQUEUE);
+    return count;
+}
+
+static size_t locked_size(QueueHandle *handle)
+{
+    return counter_get(&((LockedQueue *)handle)->size);
+}
+static size_t locked_waiting(QueueHandle *handle)
+{
+    return counter_get(&((LockedQueue *)handle)->read_queue.size);
+}
+static size_t locked_visited(QueueHandle *handle)
+{
+    return counter_get(&((LockedQueue *)handle)->visited);
+}
+
+#ifdef QUEUE_PROFILE_LOCKS
+static void locked_lock_stats(QueueHandle *handle, QueueLockStats *stats)
+{
+    read_lock_profile(&((LockedQueue *)handle)->profile, stats);
+}
+#endif
+
+static void locked_destroy(QueueHandle *handle)
+{
+    LockedQueue *q = (LockedQueue *)handle;
+    for (int i = 0; i < QUEUE_PRIORITY_LANES; i++)
+        destroy_chunks(&q->lanes[i]);
+    destroy_spares(&q->spares);
+    mtx_destroy(&q->queue_lock);
+    free(q);
+}
+
+static const QueueOps locked_ops = {
+    .enqueue = locked_enqueue,
+    .enqueue_priority = locked_enqueue_priority,
+    .enqueue_many = locked_enqueue_many,
+    .dequeue = locked_dequeue,
+    .dequeue_timeout = locked_dequeue_timeout,
+    .try_dequeue = locked_try_dequeue,
+    .try_dequeue_many = locked_try_dequeue_many,
+    .size = locked_size,
+    .waiting = locked_waiting,
+    .visited = locked_visited,
+    .destroy = locked_destroy,
+#ifdef QUEUE_PROFILE_LOCKS
+    .lock_stats = locked_lock_stats,
+#endif
+};
+
+// how many drained chunks a data queue keeps for reuse, the high watermark counts free item slots.
+static size_t spare_chunks(const QueueOptions *options)
+{
+    size_t slots = options->pool_high_watermark == 0 ? POOL_DEFAULT_HIGH_WATERMARK : options->pool_high_watermark;
+    return slots / CHUNK_ITEMS;
+}
+
+static QueueHandle *locked_create(const QueueOptions *options)
+{
+    LockedQueue *q = (LockedQueue *)aligned_alloc(_Alignof(LockedQueue), sizeof(LockedQueue));
+    if (q == NULL)
+        return NULL;
+
+    // Initialize queues values, the lanes share their spare chunks.
+    init_spares(&q->spares, spare_chunks(options), options->latency_stats);
+    for (int i = 0; i < QUEUE_PRIORITY_LANES; i++)
+        init_list(&q->lanes[i], &q->spares);
+    q->nonempty = 0;
+    atomic_init(&q->size, 0);
+    atomic_init(&q->visited, 0);
+#ifdef QUEUE_PROFILE_LOCKS
+    init_lock_profile(&q->profile);
+#endif
+    init_waiters(&q->read_queue, options);
+    if (mtx_init(&q->queue_lock, mtx_plain) != thrd_success)
+    {
+        free(q);
+        return NULL;
+    }
+    q->base.ops = &locked_ops;
+    return &q->base;
+}
+
+/* ### Two Lock Queue ### */
+// head and tail are protected by separate locks and the list always starts with a dummy node,
+// so producers (tail_lock) and consumers (head_lock) only meet when the queue is (nearly) empty.
+// the read_queue belongs to the producer side and is protected by tail_lock.
+// lock order is always head_lock before tail_lock.
+typedef struct TwoLockQueue
+{
+    QueueHandle base;
+    _Alignas(64) mtx_t head_lock;
+    Node *head;
+    _Alignas(64) mtx_t tail_lock;
+    Node *tail;
+    WaiterList read_queue;
+    // every counter has a single writer side, so none of them needs a read-modify-write:
+    // nodes linked and items handed to waiters (under tail_lock), and nodes removed (under head_lock).
+    // size is linked - removed, visited is removed + handed.
+    _Alignas(64) atomic_size_t linked;
+    atomic_size_t handed;
+    _Alignas(64) atomic_size_t removed;
+    _Alignas(64) NodePool pool;
+} TwoLockQueue;
+
+static void two_lock_enqueue(QueueHandle *handle, void *data)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    Waiter *w;
+
+    Node *tmp = alloc_node(&q->pool);
+    tmp->data = data;
+    tmp->enqueued = enqueue_stamp(handle);
+
+    mtx_lock(&q->tail_lock);
+    // waiters only register while the list is empty, so the first one gets the item directly.
+    if (counter_get(&q->read_queue.size) > 0)
+    {
+        w = remove_waiter(&q->read_queue);
+        counter_add(&q->handed, 1);
+        mtx_unlock(&q->tail_lock);
+        hand_over(w, data, tmp->enqueued);
+        release_node(&q->pool, tmp);
+        return;
+    }
+
+    // linked is raised before the node is visible so a fast consumer can never take size below zero.
+    counter_add(&q->linked, 1);
+    // release so a consumer that sees the new node also sees its data.
+    atomic_store_explicit(&q->tail->next, tmp, memory_order_release);
+    q->tail = tmp;
+    mtx_unlock(&q->tail_lock);
+}
+
+static void two_lock_enqueue_many(QueueHandle *handle, void *const *items, size_t count)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    Waiter *waiters;
+    Waiter *w;
+    Node *first;
+    Node *last;
+    Node *tmp;
+    size_t handed;
+
+    if (count == 0)
+        return;
+
+    first = alloc_chain(&q->pool, items, count, enqueue_stamp(handle), &last);
+
+    mtx_lock(&q->tail_lock);
+    waiters = remove_waiters(&q->read_queue, count, &handed);
+    counter_add(&q->handed, handed);
+    if (handed < count)
+    {
+        tmp = first;
+        for (size_t i = 0; i < handed; i++)
+            tmp = atomic_load_explicit(&tmp->next, memory_order_relaxed);
+        counter_add(&q->linked, count - handed);
+        // the chain is linked in one release store, consumers see all of it or none of it.
+        atomic_store_explicit(&q->tail->next, tmp, memory_order_release);
+        q->tail = last;
+    }
+    mtx_unlock(&q->tail_lock);
+
+    for (size_t i = 0; i < handed; i++)
+    {
+        tmp = first;
+        first = atomic_load_explicit(&tmp->next, memory_order_relaxed);
+        w = waiters;
+        waiters = w->next;
+        hand_over(w, items[i], tmp->enqueued);
+        release_node(&q->pool, tmp);
+    }
+}
+
+// must be called with head_lock held, returns the old dummy node (for the caller to release once head_lock is dropped),
+// or NULL if there is only the dummy node.
+static Node *two_lock_pop(TwoLockQueue *q, void **item)
+{
+    Node *dummy = q->head;
+    Node *first = atomic_load_explicit(&dummy->next, memory_order_acquire);
+    SojournRecorder recorder;
+    if (first == NULL)
+        return NULL;
+
+    // the first real node becomes the new dummy.
+    *item = first->data;
+    recorder = sojourn_recorder(&q->base);
+    record_sojourn(&recorder, first->enqueued, 1);
+    q->head = first;
+    counter_add(&q->removed, 1);
+    return dummy;
+}
+
+static bool two_lock_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    Waiter *w;
+    Node *dummy;
+    bool removed;
+
+    mtx_lock(&q->head_lock);
+    while ((dummy = two_lock_pop(q, item)) == NULL)
+    {
+        // the queue looks empty, check again under tail_lock so no enqueue can slip in before we are registered.
+        mtx_lock(&q->tail_lock);
+        if (atomic_load_explicit(&q->head->next, memory_order_acquire) != NULL)
+        {
+            mtx_unlock(&q->tail_lock);
+            continue;
+        }
+
+        w = local_waiter();
+        append_waiter(w, &q->read_queue);
+        mtx_unlock(&q->tail_lock);
+        mtx_unlock(&q->head_lock);
+        if (wait_for_item_until(handle, w, item, deadline))
+            return true;
+
+        // producers hand over under tail_lock, so that is the lock that decides whether we timed out.
+        mtx_lock(&q->tail_lock);
+        removed = unlink_waiter(&q->read_queue, w);
+        mtx_unlock(&q->tail_lock);
+        if (removed)
+            return false;
+        *item = wait_for_item(handle, w);
+        return true;
+    }
+    mtx_unlock(&q->head_lock);
+    release_node(&q->pool, dummy);
+    return true;
+}
+
+static void *two_lock_dequeue(QueueHandle *handle)
+{
+    void *data;
+    two_lock_dequeue_timeout(handle, &data, NULL);
+    return data;
+}
+
+static bool two_lock_try_dequeue(QueueHandle *handle, void **item)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    Node *dummy;
+
+    mtx_lock(&q->head_lock);
+    dummy = two_lock_pop(q, item);
+    mtx_unlock(&q->head_lock);
+    if (dummy == NULL)
+        return false;
+    release_node(&q->pool, dummy);
+    return true;
+}
+
+static size_t two_lock_try_dequeue_many(QueueHandle *handle, void **items, size_t max)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    SojournRecorder recorder;
+    Node *dummy;
+    Node *node;
+    Node *next;
+    size_t count = 0;
+
+    mtx_lock(&q->head_lock);
+    recorder = sojourn_recorder(handle);
+    dummy = q->head;
+    node = dummy;
+    while (count < max && (next = atomic_load_explicit(&node->next, memory_order_acquire)) != NULL)
+    {
+        items[count++] = next->data;
+        record_sojourn(&recorder, next->enqueued, 1);
+        node = next;
+    }
+    // the last node taken becomes the new dummy, the old dummy and the nodes before it are released.
+    q->head = node;
+    counter_add(&q->removed, count);
+    mtx_unlock(&q->head_lock);
+
+    release_chain(&q->pool, dummy, count, NULL);
+    return count;
+}
+
+static size_t two_lock_size(QueueHandle *handle)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    // removed first, linked can only have grown since.
+    size_t removed = counter_get(&q->removed);
+    size_t linked = counter_get(&q->linked);
+    return linked > removed ? linked - removed : 0;
+}
+static size_t two_lock_waiting(QueueHandle *handle)
+{
+    return counter_get(&((TwoLockQueue *)handle)->read_queue.size);
+}
+static size_t two_lock_visited(QueueHandle *handle)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    return counter_get(&q->removed) + counter_get(&q->handed);
+}
+
+static void two_lock_destroy(QueueHandle *handle)
+{
+    TwoLockQueue *q = (TwoLockQueue *)handle;
+    destroy_list(q->head, &q->pool);
+    destroy_pool(&q->pool);
+    mtx_destroy(&q->head_lock);
+    mtx_destroy(&q->tail_lock);
+    free(q);
+}
+
+static const QueueOps two_lock_ops = {
+    .enqueue = two_lock_enqueue,
+    .enqueue_many = two_lock_enqueue_many,
+    .dequeue = two_lock_dequeue,
+    .dequeue_timeout = two_lock_dequeue_timeout,
+    .try_dequeue = two_lock_try_dequeue,
+    .try_dequeue_many = two_lock_try_dequeue_many,
+    .size = two_lock_size,
+    .waiting = two_lock_waiting,
+    .visited = two_lock_visited,
+    .destroy = two_lock_destroy,
+};
+
+static QueueHandle *two_lock_create(const QueueOptions *options)
+{
+    TwoLockQueue *q = (TwoLockQueue *)aligned_alloc(_Alignof(TwoLockQueue), sizeof(TwoLockQueue));
+    Node *dummy;
+    if (q == NULL)
+        return NULL;
+    if (!init_pool(&q->pool, options->pool_high_watermark))
+    {
+        free(q);
+        return NULL;
+    }
+    dummy = alloc_node(&q->pool);
+    if (dummy == NULL)
+    {
+        destroy_pool(&q->pool);
+        free(q);
+        return NULL;
+    }
+
+    dummy->data = NULL;
+    q->head = dummy;
+    q->tail = dummy;
+    init_waiters(&q->read_queue, options);
+    atomic_init(&q->linked, 0);
+    atomic_init(&q->handed, 0);
+    atomic_init(&q->removed, 0);
+    if (mtx_init(&q->head_lock, mtx_plain) != thrd_success)
+    {
+        destroy_pool(&q->pool);
+        free(q);
+        return NULL;
+    }
+    if (mtx_init(&q->tail_lock, mtx_plain) != thrd_success)
+    {
+        mtx_destroy(&q->head_lock);
+        destroy_pool(&q->pool);
+        free(q);
+        return NULL;
+    }
+    q->base.ops = &two_lock_ops;
+    return &q->base;
+}
+
+/* ### Hazard Pointers ### */
+// memory reclamation for the lock free mode: a node removed from the list is only freed once no thread has it published as a hazard.
+// every thread owns one record (taken over from exited threads when possible), records are never unlinked from the global list.
+#define HAZARDS_PER_THREAD 2
+#define RETIRE_THRESHOLD 64
+
+typedef struct HazardRecord
+{
+    _Atomic(void *) hazard[HAZARDS_PER_THREAD];
+    atomic_bool active;
+    struct HazardRecord *next;
+    // nodes removed by this thread that may still be read by others.
+    Node **retired;
+    size_t retired_count;
+    size_t retired_capacity;
+} HazardRecord;
+
+static _Atomic(HazardRecord *) hazard_records;
+static tss_t hazard_key;
+static once_flag hazard_once = ONCE_FLAG_INIT;
+
+// called at thread exit, the record (and anything it still has to retire) is left for the next thread.
+static void release_hazard_record(void *record)
+{
+    HazardRecord *rec = (HazardRecord *)record;
+    for (int i = 0; i < HAZARDS_PER_THREAD; i++)
+        atomic_store(&rec->hazard[i], NULL);
+    atomic_store(&rec->active, false);
+}
+
+static void init_hazard_key(void)
+{
+    tss_create(&hazard_key, release_hazard_record);
+}
+
+static HazardRecord *hazard_record(void)
+{
+    HazardRecord *rec;
+    bool expected;
+
+    call_once(&hazard_once, init_hazard_key);
+    rec = tss_get(hazard_key);
+    if (rec != NULL)
+        return rec;
+
+    // reuse the record of a thread that has exited.
+    for (rec = atomic_load(&hazard_records); rec != NULL; rec = rec->next)
+    {
+        expected = false;
+        if (!atomic_load(&rec->active) && atomic_compare_exchange_strong(&rec->active, &expected, true))
+            break;
+    }
+
+    if (rec == NULL)
+    {
+        rec = (HazardRecord *)calloc(1, sizeof(HazardRecord));
+        for (int i = 0; i < HAZARDS_PER_THREAD; i++)
+            atomic_init(&rec->hazard[i], NULL);
+        atomic_init(&rec->active, true);
+        rec->next = atomic_load(&hazard_records);
+        while (!atomic_compare_exchange_weak(&hazard_records, &rec->next, rec))
+            ;
+    }
+
+    tss_set(hazard_key, rec);
+    return rec;
+}
+
+static bool is_hazard(void *ptr)
+{
+    for (HazardRecord *rec = atomic_load(&hazard_records); rec != NULL; rec = rec->next)
+    {
+        for (int i = 0; i < HAZARDS_PER_THREAD; i++)
+        {
+            if (atomic_load(&rec->hazard[i]) == ptr)
+                return true;
+        }
+    }
+    return false;
+}
+
+// free every retired node that is not protected by a hazard pointer.
+static void scan_retired(HazardRecord *rec)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < rec->retired_count; i++)
+    {
+        if (is_hazard(rec->retired[i]))
+            rec->retired[kept++] = rec->retired[i];
+        else
+            free(rec->retired[i]);
+    }
+    rec->retired_count = kept;
+}
+
+static void retire_node(HazardRecord *rec, Node *node)
+{
+    if (rec->retired_count == rec->retired_capacity)
+    {
+        size_t capacity = rec->retired_capacity == 0 ? RETIRE_THRESHOLD * 2 : rec->retired_capacity * 2;
+        Node **retired = (Node **)realloc(rec->retired, capacity * sizeof(Node *));
+        if (retired == NULL)
+        {
+            // keep the node alive rather than risk freeing it under a reader.
+            return;
+        }
+        rec->retired = retired;
+        rec->retired_capacity = capacity;
+    }
+    rec->retired[rec->retired_count++] = node;
+    if (rec->retired_count >= RETIRE_THRESHOLD)
+        scan_retired(rec);
+}
+
+/* ### Parking Lot ### */
+// modes without a queue wide lock block consumers here once their non blocking attempt fails.
+// a consumer announces itself in waiting before trying again, and a producer only looks for waiters after publishing its item,
+// so either the consumer sees the item or the producer sees the waiter. the bounded mode parks producers the same way while it is full.
+// a waiter sleeps on the epoch futex, which every wake up advances, so it only sleeps while nothing happened since its last attempt.
+// both sides need a full fence between their store and their load for this. an asymmetric lot moves the whole cost to the
+// waiters: they issue a process wide membarrier, which runs a fence on every thread, and producers only need a compiler
+// barrier. that makes the producer side a plain load of waiting for as long as nobody parks.
+typedef struct ParkingLot
+{
+    atomic_size_t waiting;
+    atomic_uint epoch;
+    bool asymmetric;
+} ParkingLot;
+
+static bool membarrier_registered;
+static once_flag membarrier_once = ONCE_FLAG_INIT;
+
+// the MEMBARRIER_CMD_* constants are enumerators, not macros, so only the syscall number can be tested at compile time.
+// whether the running kernel supports them is asked with MEMBARRIER_CMD_QUERY.
+static void register_membarrier(void)
+{
+#ifdef SYS_membarrier
+    long supported = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    if (supported < 0 || !(supported & MEMBARRIER_CMD_PRIVATE_EXPEDITED) ||
+        !(supported & MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED))
+        return;
+    membarrier_registered = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#endif
+}
+
+// asymmetric only takes effect where the kernel supports private expedited membarriers, the lot is symmetric otherwise.
+static void init_parking_lot(ParkingLot *lot, bool asymmetric)
+{
+    atomic_init(&lot->waiting, 0);
+    atomic_init(&lot->epoch, 0);
+    if (asymmetric)
+        call_once(&membarrier_once, register_membarrier);
+    lot->asymmetric = asymmetric && membarrier_registered;
+}
+
+// the waiter's side of the fence, called after announcing itself in waiting.
+static void park_fence(ParkingLot *lot)
+{
+#ifdef SYS_membarrier
+    if (lot->asymmetric)
+    {
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        return;
+    }
+#endif
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+// the producer's side, called after publishing items (or free slots).
+static void unpark_fence(ParkingLot *lot)
+{
+    if (lot->asymmetric)
+        atomic_signal_fence(memory_order_seq_cst);
+    else
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+// an attempt is a non blocking operation that either completes and returns true, or returns false and may be retried.
+typedef bool (*ParkAttempt)(QueueHandle *, void **);
+
+// returns false if the attempt did not succeed before deadline (NULL waits forever).
+static bool park_until(QueueHandle *q, ParkingLot *lot, ParkAttempt attempt, void **item, const struct timespec *deadline)
+{
+    unsigned int epoch;
+    for (;;)
+    {
+        if (attempt(q, item))
+            return true;
+
+        atomic_fetch_add(&lot->waiting, 1);
+        park_fence(lot);
+        epoch = atomic_load(&lot->epoch);
+        // try again now that the other side can see us.
+        if (attempt(q, item))
+        {
+            atomic_fetch_sub(&lot->waiting, 1);
+            return true;
+        }
+
+        if (!futex_wait_until(&lot->epoch, epoch, deadline))
+        {
+            atomic_fetch_sub(&lot->waiting, 1);
+            // an unpark may have picked us just as the deadline passed, do not let its wake up go to waste.
+            return attempt(q, item);
+        }
+        atomic_fetch_sub(&lot->waiting, 1);
+    }
+}
+
+static void *park_until_item(QueueHandle *q, ParkingLot *lot)
+{
+    void *data;
+    park_until(q, lot, q->ops->try_dequeue, &data, NULL);
+    return data;
+}
+
+static void unpark(ParkingLot *lot, size_t count)
+{
+    // pairs with the fence in park_until, our items (or free slots) must be visible before we look for waiters.
+    unpark_fence(lot);
+    if (atomic_load_explicit(&lot->waiting, memory_order_relaxed) == 0)
+        return;
+    atomic_fetch_add(&lot->epoch, 1);
+    futex_wake(&lot->epoch, count < INT32_MAX ? (int)count : INT32_MAX);
+}
+
+static void unpark_one(ParkingLot *lot)
+{
+    unpark(lot, 1);
+}
+
+/* ### Lock Free Queue ### */
+// Michael-Scott queue: head and tail are advanced with CAS and the list always starts with a dummy node.
+// a removed dummy is handed to the hazard pointer scheme instead of being freed directly.
+typedef struct LockFreeQueue
+{
+    QueueHandle base;
+    // head and tail are written by different threads, keep them on separate cache lines.
+    _Alignas(64) _Atomic(Node *) head;
+    _Alignas(64) _Atomic(Node *) tail;
+    _Alignas(64) atomic_size_t size;
+    atomic_size_t visited;
+    ParkingLot lot;
+} LockFreeQueue;
+
+// links a chain of count nodes (first to last) with a single CAS on the last node's next.
+static void lock_free_link(LockFreeQueue *q, Node *first, Node *last, size_t count)
+{
+    HazardRecord *rec = hazard_record();
+    Node *tail;
+    Node *next;
+
+    atomic_fetch_add_explicit(&q->size, count, memory_order_relaxed);
+    for (;;)
+    {
+        tail = atomic_load(&q->tail);
+        atomic_store(&rec->hazard[0], tail);
+        if (tail != atomic_load(&q->tail))
+            continue;
+
+        next = atomic_load(&tail->next);
+        if (next != NULL)
+        {
+            // another enqueue linked its node but did not swing tail yet, help it.
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&tail->next, &next, first))
+            break;
+    }
+    // other threads may already have walked tail through part of the chain, then this CAS fails and they finish it.
+    atomic_compare_exchange_strong(&q->tail, &tail, last);
+    atomic_store(&rec->hazard[0], NULL);
+
+    unpark(&q->lot, count);
+}
+
+static void lock_free_enqueue(QueueHandle *handle, void *data)
+{
+    Node *tmp = (Node *)malloc(sizeof(Node));
+    tmp->data = data;
+    tmp->enqueued = enqueue_stamp(handle);
+    atomic_init(&tmp->next, NULL);
+    lock_free_link((LockFreeQueue *)handle, tmp, tmp, 1);
+}
+
+static void lock_free_enqueue_many(QueueHandle *handle, void *const *items, size_t count)
+{
+    Node *first = NULL;
+    Node *last = NULL;
+    Node *tmp;
+    uint64_t stamp;
+
+    if (count == 0)
+        return;
+    stamp = enqueue_stamp(handle);
+    for (size_t i = count; i > 0; i--)
+    {
+        tmp = (Node *)malloc(sizeof(Node));
+        tmp->data = items[i - 1];
+        tmp->enqueued = stamp;
+        atomic_init(&tmp->next, first);
+        if (last == NULL)
+            last = tmp;
+        first = tmp;
+    }
+    lock_free_link((LockFreeQueue *)handle, first, last, count);
+}
+
+static bool lock_free_try_dequeue(QueueHandle *handle, void **item)
+{
+    LockFreeQueue *q = (LockFreeQueue *)handle;
+    HazardRecord *rec = hazard_record();
+    SojournRecorder recorder;
+    Node *head;
+    Node *tail;
+    Node *next;
+    uint64_t stamp;
+
+    for (;;)
+    {
+        head = atomic_load(&q->head);
+        atomic_store(&rec->hazard[0], head);
+        if (head != atomic_load(&q->head))
+            continue;
+
+        tail = atomic_load(&q->tail);
+        next = atomic_load(&head->next);
+        atomic_store(&rec->hazard[1], next);
+        if (head != atomic_load(&q->head))
+            continue;
+
+        if (next == NULL)
+        {
+            atomic_store(&rec->hazard[0], NULL);
+            atomic_store(&rec->hazard[1], NULL);
+            return false;
+        }
+        if (head == tail)
+        {
+            // tail is lagging behind a linked node, help it before removing head.
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+
+        // next is protected by hazard[1], so reading its data is safe even if another thread wins the CAS.
+        *item = next->data;
+        stamp = next->enqueued;
+        if (atomic_compare_exchange_strong(&q->head, &head, next))
+            break;
+    }
+
+    atomic_store(&rec->hazard[0], NULL);
+    atomic_store(&rec->hazard[1], NULL);
+    recorder = sojourn_recorder(handle);
+    record_sojourn(&recorder, stamp, 1);
+    atomic_fetch_sub_explicit(&q->size, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&q->visited, 1, memory_order_relaxed);
+    retire_node(rec, head);
+    return true;
+}
+
+static void *lock_free_dequeue(QueueHandle *handle)
+{
+    return park_until_item(handle, &((LockFreeQueue *)handle)->lot);
+}
+
+static bool lock_free_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    return park_until(handle, &((LockFreeQueue *)handle)->lot, lock_free_try_dequeue, item, deadline);
+}
+
+static size_t lock_free_size(QueueHandle *handle)
+{
+    return atomic_load_explicit(&((LockFreeQueue *)handle)->size, memory_order_relaxed);
+}
+static size_t lock_free_waiting(QueueHandle *handle)
+{
+    return atomic_load(&((LockFreeQueue *)handle)->lot.waiting);
+}
+static size_t lock_free_visited(QueueHandle *handle)
+{
+    return atomic_load_explicit(&((LockFreeQueue *)handle)->visited, memory_order_relaxed);
+}
+
+static void lock_free_destroy(QueueHandle *handle)
+{
+    LockFreeQueue *q = (LockFreeQueue *)handle;
+    // no other thread may use the queue anymore, so the remaining nodes can be freed directly.
+    destroy_list(atomic_load(&q->head), NULL);
+    free(q);
+}
+
+static const QueueOps lock_free_ops = {
+    .enqueue = lock_free_enqueue,
+    .enqueue_many = lock_free_enqueue_many,
+    .dequeue = lock_free_dequeue,
+    .dequeue_timeout = lock_free_dequeue_timeout,
+    .try_dequeue = lock_free_try_dequeue,
+    .size = lock_free_size,
+    .waiting = lock_free_waiting,
+    .visited = lock_free_visited,
+    .destroy = lock_free_destroy,
+};
+
+static QueueHandle *lock_free_create(void)
+{
+    LockFreeQueue *q = (LockFreeQueue *)aligned_alloc(_Alignof(LockFreeQueue), sizeof(LockFreeQueue));
+    Node *dummy = (Node *)malloc(sizeof(Node));
+    if (q == NULL || dummy == NULL)
+    {
+        free(q);
+        free(dummy);
+        return NULL;
+    }
+    init_parking_lot(&q->lot, false);
+
+    dummy->data = NULL;
+    atomic_init(&dummy->next, NULL);
+    atomic_init(&q->head, dummy);
+    atomic_init(&q->tail, dummy);
+    atomic_init(&q->size, 0);
+    atomic_init(&q->visited, 0);
+    q->base.ops = &lock_free_ops;
+    return &q->base;
+}
+
+/* ### Ring Queue ### */
+// bounded MPMC ring (Vyukov): every slot carries a sequence number telling whether it is ready to be written (== position)
+// or read (== position + 1) in the current lap, so producers and consumers only contend on their own position counter.
+// items live in one preallocated array, there is no allocation per item.
+#define RING_DEFAULT_CAPACITY 1024
+
+typedef struct RingSlot
+{
+    atomic_size_t sequence;
+    void *data;
+} RingSlot;
+
+typedef struct RingQueue
+{
+    QueueHandle base;
+    RingSlot *slots;
+    // the enqueue time of slots[i] is stamps[i], NULL without latency stats.
+    uint64_t *stamps;
+    size_t mask;
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos;
+    _Alignas(64) atomic_size_t visited;
+    // consumers wait in readers while the ring is empty, producers in writers while it is full.
+    ParkingLot readers;
+    ParkingLot writers;
+} RingQueue;
+
+static bool ring_try_enqueue(QueueHandle *handle, void *data)
+{
+    RingQueue *q = (RingQueue *)handle;
+    RingSlot *slot;
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    size_t seq;
+    intptr_t diff;
+
+    for (;;)
+    {
+        slot = &q->slots[pos & q->mask];
+        seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // the slot still holds an item from the previous lap, the ring is full.
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->data = data;
+    if (q->stamps != NULL)
+        q->stamps[pos & q->mask] = enqueue_stamp(handle);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    unpark_one(&q->readers);
+    return true;
+}
+
+static bool ring_try_dequeue(QueueHandle *handle, void **item)
+{
+    RingQueue *q = (RingQueue *)handle;
+    RingSlot *slot;
+    SojournRecorder recorder;
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    size_t seq;
+    intptr_t diff;
+
+    for (;;)
+    {
+        slot = &q->slots[pos & q->mask];
+        seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // the slot was not written in this lap yet, the ring is empty.
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *item = slot->data;
+    if (q->stamps != NULL)
+    {
+        recorder = sojourn_recorder(handle);
+        record_sojourn(&recorder, q->stamps[pos & q->mask], 1);
+    }
+    // hand the slot to the producer of the next lap.
+    atomic_store_explicit(&slot->sequence, pos + q->mask + 1, memory_order_release);
+    atomic_fetch_add_explicit(&q->visited, 1, memory_order_relaxed);
+    unpark_one(&q->writers);
+    return true;
+}
+
+static bool ring_attempt_enqueue(QueueHandle *handle, void **item)
+{
+    return ring_try_enqueue(handle, *item);
+}
+
+static void ring_enqueue(QueueHandle *handle, void *data)
+{
+    park_until(handle, &((RingQueue *)handle)->writers, ring_attempt_enqueue, &data, NULL);
+}
+
+static void *ring_dequeue(QueueHandle *handle)
+{
+    return park_until_item(handle, &((RingQueue *)handle)->readers);
+}
+
+static bool ring_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    return park_until(handle, &((RingQueue *)handle)->readers, ring_try_dequeue, item, deadline);
+}
+
+static size_t ring_size(QueueHandle *handle)
+{
+    RingQueue *q = (RingQueue *)handle;
+    size_t dequeued = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    size_t enqueued = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    // both positions are claimed before the slot is filled / emptied, so this counts in flight operations too.
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+static size_t ring_waiting(QueueHandle *handle)
+{
+    return atomic_load(&((RingQueue *)handle)->readers.waiting);
+}
+static size_t ring_visited(QueueHandle *handle)
+{
+    return atomic_load_explicit(&((RingQueue *)handle)->visited, memory_order_relaxed);
+}
+
+static void ring_destroy(QueueHandle *handle)
+{
+    RingQueue *q = (RingQueue *)handle;
+    free(q->slots);
+    free(q->stamps);
+    free(q);
+}
+
+static const QueueOps ring_ops = {
+    .enqueue = ring_enqueue,
+    .try_enqueue = ring_try_enqueue,
+    .dequeue = ring_dequeue,
+    .dequeue_timeout = ring_dequeue_timeout,
+    .try_dequeue = ring_try_dequeue,
+    .size = ring_size,
+    .waiting = ring_waiting,
+    .visited = ring_visited,
+    .destroy = ring_destroy,
+};
+
+// positions are mapped to slots with a mask, so the capacity is rounded up to a power of two.
+static size_t ring_slots(size_t capacity)
+{
+    size_t slots = 2;
+    if (capacity == 0)
+        capacity = RING_DEFAULT_CAPACITY;
+    while (slots < capacity)
+        slots <<= 1;
+    return slots;
+}
+
+static QueueHandle *ring_create(const QueueOptions *options)
+{
+    RingQueue *q;
+    size_t slots = ring_slots(options->capacity);
+
+    q = (RingQueue *)aligned_alloc(_Alignof(RingQueue), sizeof(RingQueue));
+    if (q == NULL)
+        return NULL;
+    q->slots = (RingSlot *)malloc(slots * sizeof(RingSlot));
+    q->stamps = options->latency_stats ? (uint64_t *)malloc(slots * sizeof(uint64_t)) : NULL;
+    if (q->slots == NULL || (options->latency_stats && q->stamps == NULL))
+    {
+        free(q->slots);
+        free(q->stamps);
+        free(q);
+        return NULL;
+    }
+    init_parking_lot(&q->readers, false);
+    init_parking_lot(&q->writers, false);
+
+    for (size_t i = 0; i < slots; i++)
+    {
+        atomic_init(&q->slots[i].sequence, i);
+        q->slots[i].data = NULL;
+    }
+    q->mask = slots - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->visited, 0);
+    q->base.ops = &ring_ops;
+    return &q->base;
+}
+
+/* ### Sharded Queue ### */
+// N independent locked sub-queues. every thread has a home shard it enqueues to and dequeues from first,
+// a consumer whose home shard is empty steals from the other shards in turn (the next one first).
+// FIFO only holds within a shard: the items of one producer stay in order, items of different producers may overtake each other.
+// consumers that find every shard empty park on a parking lot like the lock free mode.
+// with the numa option the shards are split evenly between the NUMA nodes, each node's shards live in memory bound to
+// that node, a thread's home shard is one of the shards of the node it runs on, and consumers steal from the shards
+// of their own node before they go to a remote one. without the option all shards count as one node.
+// only the shards themselves are bound: their item chunks come from malloc, too small to bind one by one, and are
+// placed by first touch, mostly by a producer of the shard's own node.
+#define SHARD_MAX_NODES 64
+
+typedef struct Shard
+{
+    _Alignas(64) mtx_t lock;
+    Queue items;
+    ChunkSpares spares;
+    // mirror items.size and items.visited, so consumers skip empty shards and size() sums up without taking the locks.
+    _Alignas(64) atomic_size_t size;
+    atomic_size_t visited;
+} Shard;
+
+typedef struct ShardedQueue
+{
+    QueueHandle base;
+    size_t count;
+    // count = nodes * per_node, nodes[n] holds the per_node shards of node n.
+    size_t per_node;
+    size_t node_count;
+    Shard *nodes[SHARD_MAX_NODES];
+    ParkingLot lot;
+} ShardedQueue;
+
+// threads are spread over the shards in the order they first use a sharded queue, 0 means not assigned yet.
+static atomic_uint next_shard_hint;
+static _Thread_local unsigned int shard_hint;
+// NUMA node + 1 the thread ran on when it first used a sharded queue, 0 means not looked up yet.
+// a thread that migrates to another node later keeps its home shard, pin consumers to keep them node local.
+static _Thread_local unsigned int shard_node;
+
+// number of NUMA nodes the kernel has online, 1 if it does not report any.
+static size_t numa_node_count(void)
+{
+    FILE *file = fopen("/sys/devices/system/node/online", "r");
+    unsigned int node;
+    size_t count = 1;
+
+    if (file == NULL)
+        return 1;
+    // a list of ranges like "0-1,3", the highest node decides.
+    while (fscanf(file, "%u", &node) == 1 && node < SHARD_MAX_NODES)
+    {
+        if (node + 1 > count)
+            count = node + 1;
+        if (fgetc(file) == EOF)
+            break;
+    }
+    fclose(file);
+    return count;
+}
+
+// best effort: without NUMA support in the kernel the memory stays wherever the allocator put it.
+static void bind_to_node(void *memory, size_t bytes, size_t node)
+{
+#ifdef SYS_mbind
+    unsigned long mask = 1ul << node;
+    syscall(SYS_mbind, memory, bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+#else
+    (void)memory;
+    (void)bytes;
+    (void)node;
+#endif
+}
+
+static size_t thread_node(void)
+{
+#ifdef SYS_getcpu
+    unsigned int cpu;
+    unsigned int node;
+    if (shard_node == 0)
+        shard_node = syscall(SYS_getcpu, &cpu, &node, NULL) == 0 ? node + 1 : 1;
+    return shard_node - 1;
+#else
+    // without getcpu every thread counts as running on node 0.
+    shard_node = 1;
+    return 0;
+#endif
+}
+
+// the i-th shard a thread visits: its home shard first, then the rest of its node, then the other nodes in turn.
+static Shard *shard_order(ShardedQueue *q, size_t i)
+{
+    size_t node = q->node_count > 1 ? thread_node() : 0;
+    if (shard_hint == 0)
+        shard_hint = atomic_fetch_add_explicit(&next_shard_hint, 1, memory_order_relaxed) + 1;
+    return &q->nodes[(node + i / q->per_node) % q->node_count][(shard_hint - 1 + i) % q->per_node];
+}
+
+static Shard *shard_at(ShardedQueue *q, size_t index)
+{
+    return &q->nodes[index / q->per_node][index % q->per_node];
+}
+
+static void sharded_enqueue_many(QueueHandle *handle, void *const *items, size_t count)
+{
+    ShardedQueue *q = (ShardedQueue *)handle;
+    Shard *shard = shard_order(q, 0);
+    uint64_t stamp;
+
+    if (count == 0)
+        return;
+
+    stamp = enqueue_stamp(handle);
+    mtx_lock(&shard->lock);
+    append_items(items, count, stamp, &shard->items);
+    counter_add(&shard->size, count);
+    mtx_unlock(&shard->lock);
+
+    unpark(&q->lot, count);
+}
+
+static void sharded_enqueue(QueueHandle *handle, void *data)
+{
+    sharded_enqueue_many(handle, &data, 1);
+}
+
+static size_t shard_take(QueueHandle *handle, Shard *shard, void **items, size_t max)
+{
+    SojournRecorder recorder;
+    size_t count;
+    if (counter_get(&shard->size) == 0)
+        return 0;
+
+    mtx_lock(&shard->lock);
+    count = shard->items.size < max ? shard->items.size : max;
+    recorder = sojourn_recorder(handle);
+    remove_items(&shard->items, items, count, &recorder);
+    counter_sub(&shard->size, count);
+    counter_add(&shard->visited, count);
+    mtx_unlock(&shard->lock);
+    return count;
+}
+
+static size_t sharded_try_dequeue_many(QueueHandle *handle, void **items, size_t max)
+{
+    ShardedQueue *q = (ShardedQueue *)handle;
+    size_t count = 0;
+
+    for (size_t i = 0; i < q->count && count < max; i++)
+        count += shard_take(handle, shard_order(q, i), items + count, max - count);
+    return count;
+}
+
+static bool sharded_try_dequeue(QueueHandle *handle, void **item)
+{
+    return sharded_try_dequeue_many(handle, item, 1) == 1;
+}
+
+static bool sharded_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    return park_until(handle, &((ShardedQueue *)handle)->lot, sharded_try_dequeue, item, deadline);
+}
+
+static void *sharded_dequeue(QueueHandle *handle)
+{
+    return park_until_item(handle, &((ShardedQueue *)handle)->lot);
+}
+
+static size_t sharded_size(QueueHandle *handle)
+{
+    ShardedQueue *q = (ShardedQueue *)handle;
+    size_t size = 0;
+    for (size_t i = 0; i < q->count; i++)
+        size += counter_get(&shard_at(q, i)->size);
+    return size;
+}
+static size_t sharded_waiting(QueueHandle *handle)
+{
+    return atomic_load(&((ShardedQueue *)handle)->lot.waiting);
+}
+static size_t sharded_visited(QueueHandle *handle)
+{
+    ShardedQueue *q = (ShardedQueue *)handle;
+    size_t visited = 0;
+    for (size_t i = 0; i < q->count; i++)
+        visited += counter_get(&shard_at(q, i)->visited);
+    return visited;
+}
+
+static void sharded_destroy(QueueHandle *handle)
+{
+    ShardedQueue *q = (ShardedQueue *)handle;
+    for (size_t i = 0; i < q->count; i++)
+    {
+        destroy_chunks(&shard_at(q, i)->items);
+        destroy_spares(&shard_at(q, i)->spares);
+        mtx_destroy(&shard_at(q, i)->lock);
+    }
+    for (size_t n = 0; n < q->node_count; n++)
+        free(q->nodes[n]);
+    free(q);
+}
+
+static const QueueOps sharded_ops = {
+    .enqueue = sharded_enqueue,
+    .enqueue_many = sharded_enqueue_many,
+    .dequeue = sharded_dequeue,
+    .dequeue_timeout = sharded_dequeue_timeout,
+    .try_dequeue = sharded_try_dequeue,
+    .try_dequeue_many = sharded_try_dequeue_many,
+    .size = sharded_size,
+    .waiting = sharded_waiting,
+    .visited = sharded_visited,
+    .destroy = sharded_destroy,
+};
+
+static QueueHandle *sharded_create(const QueueOptions *options)
+{
+    ShardedQueue *q = (ShardedQueue *)aligned_alloc(_Alignof(ShardedQueue), sizeof(ShardedQueue));
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long page = sysconf(_SC_PAGESIZE);
+    size_t count = options->shards != 0 ? options->shards : (cpus > 0 ? (size_t)cpus : 1);
+    size_t node_count = options->numa ? numa_node_count() : 1;
+    // every node gets the same number of shards (and at least one), rounding count up.
+    size_t per_node = (count + node_count - 1) / node_count;
+    size_t bytes = per_node * sizeof(Shard);
+    size_t align = _Alignof(Shard);
+    size_t n;
+    size_t i;
+
+    if (q == NULL)
+        return NULL;
+    count = per_node * node_count;
+    // whole pages per node, so binding one node's shards does not move those of another.
+    if (node_count > 1 && page > 0)
+    {
+        align = (size_t)page;
+        bytes = (bytes + align - 1) / align * align;
+    }
+    for (n = 0; n < node_count; n++)
+    {
+        q->nodes[n] = (Shard *)aligned_alloc(align, bytes);
+        if (q->nodes[n] == NULL)
+            break;
+        if (node_count > 1)
+            bind_to_node(q->nodes[n], bytes, n);
+    }
+    if (n < node_count)
+    {
+        while (n > 0)
+            free(q->nodes[--n]);
+        free(q);
+        return NULL;
+    }
+
+    q->count = count;
+    q->per_node = per_node;
+    q->node_count = node_count;
+    for (i = 0; i < count; i++)
+    {
+        Shard *shard = shard_at(q, i);
+        if (mtx_init(&shard->lock, mtx_plain) != thrd_success)
+            break;
+        // the spare chunks are split between the shards.
+        init_spares(&shard->spares, spare_chunks(options) / count, options->latency_stats);
+        init_list(&shard->items, &shard->spares);
+        atomic_init(&shard->size, 0);
+        atomic_init(&shard->visited, 0);
+    }
+    if (i < count)
+    {
+        while (i > 0)
+            mtx_destroy(&shard_at(q, --i)->lock);
+        for (n = 0; n < node_count; n++)
+            free(q->nodes[n]);
+        free(q);
+        return NULL;
+    }
+
+    init_parking_lot(&q->lot, false);
+    q->base.ops = &sharded_ops;
+    return &q->base;
+}
+
+/* ### Single Producer Single Consumer Queue ### */
+// a bounded ring for exactly one producer thread and one consumer thread at a time, so both positions have a single writer
+// and need no CAS: tryEnqueue and tryDequeue finish in a fixed number of steps. each side keeps a copy of the other side's
+// position and only reloads it (touching the other side's cache line) once the copy says the ring is full / empty.
+// visited is the consumer position itself, size the distance between both positions.
+// both parking lots are asymmetric, so as long as neither side is parked an operation only touches the two positions
+// and reads the other side's waiting count, without any fence.
+typedef struct SpscQueue
+{
+    QueueHandle base;
+    void **items;
+    // the enqueue time of items[i] is stamps[i], NULL without latency stats.
+    uint64_t *stamps;
+    size_t mask;
+    // consumers wait in readers while the ring is empty, the producer in writers while it is full.
+    ParkingLot readers;
+    ParkingLot writers;
+    // written by the consumer only.
+    _Alignas(64) atomic_size_t head;
+    size_t cached_tail;
+    // written by the producer only.
+    _Alignas(64) atomic_size_t tail;
+    size_t cached_head;
+} SpscQueue;
+
+static bool spsc_try_enqueue(QueueHandle *handle, void *data)
+{
+    SpscQueue *q = (SpscQueue *)handle;
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    if (tail - q->cached_head > q->mask)
+    {
+        q->cached_head = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail - q->cached_head > q->mask)
+            return false;
+    }
+    q->items[tail & q->mask] = data;
+    if (q->stamps != NULL)
+        q->stamps[tail & q->mask] = enqueue_stamp(handle);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    unpark_one(&q->readers);
+    return true;
+}
+
+static size_t spsc_try_dequeue_many(QueueHandle *handle, void **items, size_t max)
+{
+    SpscQueue *q = (SpscQueue *)handle;
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    SojournRecorder recorder;
+    size_t count;
+
+    if (head == q->cached_tail)
+    {
+        q->cached_tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head == q->cached_tail)
+            return 0;
+    }
+    count = q->cached_tail - head < max ? q->cached_tail - head : max;
+    for (size_t i = 0; i < count; i++)
+        items[i] = q->items[(head + i) & q->mask];
+    if (q->stamps != NULL)
+    {
+        recorder = sojourn_recorder(handle);
+        for (size_t i = 0; i < count; i++)
+            record_sojourn(&recorder, q->stamps[(head + i) & q->mask], 1);
+    }
+    atomic_store_explicit(&q->head, head + count, memory_order_release);
+    unpark_one(&q->writers);
+    return count;
+}
+
+static bool spsc_try_dequeue(QueueHandle *handle, void **item)
+{
+    return spsc_try_dequeue_many(handle, item, 1) == 1;
+}
+
+static bool spsc_attempt_enqueue(QueueHandle *handle, void **item)
+{
+    return spsc_try_enqueue(handle, *item);
+}
+
+static void spsc_enqueue(QueueHandle *handle, void *data)
+{
+    park_until(handle, &((SpscQueue *)handle)->writers, spsc_attempt_enqueue, &data, NULL);
+}
+
+static void *spsc_dequeue(QueueHandle *handle)
+{
+    return park_until_item(handle, &((SpscQueue *)handle)->readers);
+}
+
+static bool spsc_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    return park_until(handle, &((SpscQueue *)handle)->readers, spsc_try_dequeue, item, deadline);
+}
+
+static size_t spsc_size(QueueHandle *handle)
+{
+    SpscQueue *q = (SpscQueue *)handle;
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+static size_t spsc_waiting(QueueHandle *handle)
+{
+    return atomic_load(&((SpscQueue *)handle)->readers.waiting);
+}
+static size_t spsc_visited(QueueHandle *handle)
+{
+    return atomic_load_explicit(&((SpscQueue *)handle)->head, memory_order_relaxed);
+}
+
+static void spsc_destroy(QueueHandle *handle)
+{
+    SpscQueue *q = (SpscQueue *)handle;
+    free(q->items);
+    free(q->stamps);
+    free(q);
+}
+
+static const QueueOps spsc_ops = {
+    .enqueue = spsc_enqueue,
+    .try_enqueue = spsc_try_enqueue,
+    .dequeue = spsc_dequeue,
+    .dequeue_timeout = spsc_dequeue_timeout,
+    .try_dequeue = spsc_try_dequeue,
+    .try_dequeue_many = spsc_try_dequeue_many,
+    .size = spsc_size,
+    .waiting = spsc_waiting,
+    .visited = spsc_visited,
+    .destroy = spsc_destroy,
+};
+
+static QueueHandle *spsc_create(const QueueOptions *options)
+{
+    size_t slots = ring_slots(options->capacity);
+    SpscQueue *q = (SpscQueue *)aligned_alloc(_Alignof(SpscQueue), sizeof(SpscQueue));
+    void **items = (void **)malloc(slots * sizeof(void *));
+    uint64_t *stamps = options->latency_stats ? (uint64_t *)malloc(slots * sizeof(uint64_t)) : NULL;
+    if (q == NULL || items == NULL || (options->latency_stats && stamps == NULL))
+    {
+        free(q);
+        free(items);
+        free(stamps);
+        return NULL;
+    }
+
+    q->items = items;
+    q->stamps = stamps;
+    q->mask = slots - 1;
+    init_parking_lot(&q->readers, true);
+    init_parking_lot(&q->writers, true);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->cached_tail = 0;
+    q->cached_head = 0;
+    q->base.ops = &spsc_ops;
+    return &q->base;
+}
+
+/* ### Stamp Runs ### */
+// the enqueue times of a list's items in FIFO order, for lists with no room for a stamp per item: a ring of runs, each the
+// stamp of a stretch of consecutive items. items enqueued within window ns of the newest run join it, and so does
+// everything once the ring can not grow, so a run's stamp can be slightly later than the enqueue of its later items.
+#define STAMP_INITIAL_RUNS 16
+
+typedef struct StampRun
+{
+    uint64_t stamp;
+    size_t count;
+} StampRun;
+
+typedef struct StampRuns
+{
+    // count runs from head on, the ring only grows (doubling its capacity, a power of two).
+    StampRun *ring;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} StampRuns;
+
+static bool init_runs(StampRuns *runs)
+{
+    runs->ring = (StampRun *)malloc(STAMP_INITIAL_RUNS * sizeof(StampRun));
+    runs->head = 0;
+    runs->count = 0;
+    runs->capacity = STAMP_INITIAL_RUNS;
+    return runs->ring != NULL;
+}
+
+static void destroy_runs(StampRuns *runs)
+{
+    free(runs->ring);
+    runs->ring = NULL;
+}
+
+// records count items enqueued at stamp.
+static void add_run(StampRuns *runs, uint64_t stamp, size_t count, uint64_t window)
+{
+    StampRun *last = runs->count == 0 ? NULL : &runs->ring[(runs->head + runs->count - 1) & (runs->capacity - 1)];
+    StampRun *ring;
+
+    // stamps are taken before the list's lock, so one may even be older than the newest run.
+    if (last != NULL && stamp <= last->stamp + window)
+    {
+        last->count += count;
+        return;
+    }
+    if (runs->count == runs->capacity)
+    {
+        ring = (StampRun *)malloc(2 * runs->capacity * sizeof(StampRun));
+        if (ring == NULL)
+        {
+            last->count += count;
+            return;
+        }
+        for (size_t i = 0; i < runs->count; i++)
+            ring[i] = runs->ring[(runs->head + i) & (runs->capacity - 1)];
+        free(runs->ring);
+        runs->ring = ring;
+        runs->head = 0;
+        runs->capacity *= 2;
+    }
+    runs->ring[(runs->head + runs->count) & (runs->capacity - 1)] = (StampRun){stamp, count};
+    runs->count++;
+}
+
+// drops the oldest count items, recording their sojourn when recorder is not NULL.
+static void take_runs(StampRuns *runs, size_t count, const SojournRecorder *recorder)
+{
+    StampRun *run;
+    size_t n;
+    while (count > 0)
+    {
+        run = &runs->ring[runs->head];
+        n = run->count < count ? run->count : count;
+        if (recorder != NULL)
+            record_sojourn(recorder, run->stamp, n);
+        count -= n;
+        run->count -= n;
+        if (run->count > 0)
+            break;
+        runs->head = (runs->head + 1) & (runs->capacity - 1);
+        runs->count--;
+    }
+}
+
+// the stamp of the oldest item, empty if there is none.
+static uint64_t oldest_stamp(const StampRuns *runs, uint64_t empty)
+{
+    return runs->count == 0 ? empty : runs->ring[runs->head].stamp;
+}
+
+/* ### Intrusive Queue ### */
+// items are QueueLink records embedded in the caller's own structures and linked through their next field,
+// so neither enqueue nor dequeue allocates anything. otherwise this is the locked mode with a single lane:
+// one lock for the list and the read queue, and enqueue hands its item straight to the first waiter.
+// a link has no room for a stamp, with latency stats the enqueue times are kept as exact stamp runs beside the list.
+typedef struct IntrusiveQueue
+{
+    QueueHandle base;
+    mtx_t lock;
+    QueueLink *head;
+    QueueLink *tail;
+    // ring is NULL without latency stats.
+    StampRuns runs;
+    // threads blocked in dequeue, in wake order (see Waiters).
+    WaiterList read_queue;
+    // written under lock.
+    _Alignas(64) atomic_size_t size;
+    atomic_size_t visited;
+} IntrusiveQueue;
+
+// unlinks up to max items from the head, must be called with lock held.
+static size_t intrusive_take(IntrusiveQueue *q, void **items, size_t max)
+{
+    SojournRecorder recorder;
+    size_t count = 0;
+    while (count < max && q->head != NULL)
+    {
+        items[count++] = q->head;
+        q->head = q->head->next;
+    }
+    if (q->head == NULL)
+        q->tail = NULL;
+    if (q->runs.ring != NULL)
+    {
+        recorder = sojourn_recorder(&q->base);
+        take_runs(&q->runs, count, &recorder);
+    }
+    counter_sub(&q->size, count);
+    counter_add(&q->visited, count);
+    return count;
+}
+
+static void intrusive_enqueue_many(QueueHandle *handle, void *const *items, size_t count)
+{
+    IntrusiveQueue *q = (IntrusiveQueue *)handle;
+    QueueLink *link;
+    Waiter *waiters;
+    Waiter *w;
+    uint64_t stamp;
+    size_t handed;
+
+    if (count == 0)
+        return;
+
+    stamp = enqueue_stamp(handle);
+    mtx_lock(&q->lock);
+    // the first items go to the waiters in order, the rest is linked behind tail.
+    waiters = remove_waiters(&q->read_queue, count, &handed);
+    counter_add(&q->visited, handed);
+    for (size_t i = handed; i < count; i++)
+    {
+        link = (QueueLink *)items[i];
+        link->next = NULL;
+        if (q->head == NULL)
+            q->head = link;
+        else
+            q->tail->next = link;
+        q->tail = link;
+    }
+    if (q->runs.ring != NULL && handed < count)
+        add_run(&q->runs, stamp, count - handed, 0);
+    counter_add(&q->size, count - handed);
+    mtx_unlock(&q->lock);
+
+    for (size_t i = 0; i < handed; i++)
+    {
+        // next of a waiter is not touched once it was handed over, so read it first.
+        w = waiters;
+        waiters = w->next;
+        hand_over(w, items[i], stamp);
+    }
+}
+
+static void intrusive_enqueue(QueueHandle *handle, void *data)
+{
+    intrusive_enqueue_many(handle, &data, 1);
+}
+
+static bool intrusive_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    IntrusiveQueue *q = (IntrusiveQueue *)handle;
+    Waiter *w;
+    bool removed;
+
+    mtx_lock(&q->lock);
+    if (q->head == NULL)
+    {
+        w = local_waiter();
+        append_waiter(w, &q->read_queue);
+        mtx_unlock(&q->lock);
+        if (wait_for_item_until(handle, w, item, deadline))
+            return true;
+
+        // timed out, unless an enqueue took us off read_queue in the meantime and its item is on the way.
+        mtx_lock(&q->lock);
+        removed = unlink_waiter(&q->read_queue, w);
+        mtx_unlock(&q->lock);
+        if (removed)
+            return false;
+        *item = wait_for_item(handle, w);
+        return true;
+    }
+
+    intrusive_take(q, item, 1);
+    mtx_unlock(&q->lock);
+    return true;
+}
+
+static void *intrusive_dequeue(QueueHandle *handle)
+{
+    void *data;
+    intrusive_dequeue_timeout(handle, &data, NULL);
+    return data;
+}
+
+static size_t intrusive_try_dequeue_many(QueueHandle *handle, void **items, size_t max)
+{
+    IntrusiveQueue *q = (IntrusiveQueue *)handle;
+    size_t count;
+
+    if (counter_get(&q->size) == 0)
+        return 0;
+
+    mtx_lock(&q->lock);
+    count = intrusive_take(q, items, max);
+    mtx_unlock(&q->lock);
+    return count;
+}
+
+static bool intrusive_try_dequeue(QueueHandle *handle, void **item)
+{
+    return intrusive_try_dequeue_many(handle, item, 1) == 1;
+}
+
+static size_t intrusive_size(QueueHandle *handle)
+{
+    return counter_get(&((IntrusiveQueue *)handle)->size);
+}
+static size_t intrusive_waiting(QueueHandle *handle)
+{
+    return counter_get(&((IntrusiveQueue *)handle)->read_queue.size);
+}
+static size_t intrusive_visited(QueueHandle *handle)
+{
+    return counter_get(&((IntrusiveQueue *)handle)->visited);
+}
+
+// the items still linked belong to the caller, only the queue itself is freed.
+static void intrusive_destroy(QueueHandle *handle)
+{
+    IntrusiveQueue *q = (IntrusiveQueue *)handle;
+    destroy_runs(&q->runs);
+    mtx_destroy(&q->lock);
+    free(q);
+}
+
+static const QueueOps intrusive_ops = {
+    .enqueue = intrusive_enqueue,
+    .enqueue_many = intrusive_enqueue_many,
+    .dequeue = intrusive_dequeue,
+    .dequeue_timeout = intrusive_dequeue_timeout,
+    .try_dequeue = intrusive_try_dequeue,
+    .try_dequeue_many = intrusive_try_dequeue_many,
+    .size = intrusive_size,
+    .waiting = intrusive_waiting,
+    .visited = intrusive_visited,
+    .destroy = intrusive_destroy,
+};
+
+static QueueHandle *intrusive_create(const QueueOptions *options)
+{
+    IntrusiveQueue *q = (IntrusiveQueue *)aligned_alloc(_Alignof(IntrusiveQueue), sizeof(IntrusiveQueue));
+    if (q == NULL)
+        return NULL;
+    q->runs.ring = NULL;
+    if (options->latency_stats && !init_runs(&q->runs))
+    {
+        free(q);
+        return NULL;
+    }
+    if (mtx_init(&q->lock, mtx_plain) != thrd_success)
+    {
+        destroy_runs(&q->runs);
+        free(q);
+        return NULL;
+    }
+    q->head = NULL;
+    q->tail = NULL;
+    init_waiters(&q->read_queue, options);
+    atomic_init(&q->size, 0);
+    atomic_init(&q->visited, 0);
+    q->base.ops = &intrusive_ops;
+    return &q->base;
+}
+
+/* ### Combining Queue ### */
+// flat combining: a thread publishes its operation in a slot of the queue's publication array, and whichever thread
+// sets the combining flag applies every published operation in one pass. the data queue (an unrolled list like the locked
+// mode's) stays in the combiner's cache instead of moving to every thread that touches it, the others spin on their own
+// slot until it is marked done, or combine themselves once the flag is clear. they only read the flag until then
+// (test and test and set), and it has a line of its own, so waiting threads never pull the combiner's lines away.
+// every thread looks for a free slot starting at one of its own, so its slot's cache line normally only moves between
+// it and the combiner.
+// consumers that find the queue empty park on a parking lot like the lock free mode.
+#define COMBINE_SLOTS 64
+#define COMBINE_YIELD_EVERY 64
+
+enum
+{
+    COMBINE_IDLE,
+    COMBINE_PENDING,
+    COMBINE_DONE,
+};
+
+typedef struct CombineOp
+{
+    bool enqueue;
+    // enqueue: the count items to append, enqueued at stamp. dequeue: room for count items, count is set to how many were taken.
+    void *const *in;
+    void **out;
+    size_t count;
+    uint64_t stamp;
+} CombineOp;
+
+typedef struct CombineSlot
+{
+    _Alignas(64) atomic_bool owned;
+    atomic_uint state;
+    CombineOp op;
+} CombineSlot;
+
+typedef struct CombiningQueue
+{
+    QueueHandle base;
+    // set while a thread combines, it owns items and spares until it clears it.
+    _Alignas(64) atomic_bool combining;
+    _Alignas(64) Queue items;
+    ChunkSpares spares;
+    CombineSlot slots[COMBINE_SLOTS];
+    // written by the combiner only.
+    _Alignas(64) atomic_size_t size;
+    atomic_size_t visited;
+    ParkingLot lot;
+} CombiningQueue;
+
+// threads are spread over the slots in the order they first use a combining queue, 0 means not assigned yet.
+static atomic_uint next_combine_hint;
+static _Thread_local unsigned int combine_hint;
+
+// must be called as the combiner, which records the sojourn of the items it takes for other threads as well.
+static void combine_apply(CombiningQueue *q, CombineOp *op, const SojournRecorder *recorder)
+{
+    size_t n;
+    if (op->enqueue)
+    {
+        append_items(op->in, op->count, op->stamp, &q->items);
+        counter_add(&q->size, op->count);
+        return;
+    }
+    n = q->items.size < op->count ? q->items.size : op->count;
+    remove_items(&q->items, op->out, n, recorder);
+    counter_sub(&q->size, n);
+    counter_add(&q->visited, n);
+    op->count = n;
+}
+
+// applies every published operation, must be called as the combiner.
+static void combine(CombiningQueue *q, const SojournRecorder *recorder)
+{
+    CombineSlot *slot;
+    for (size_t i = 0; i < COMBINE_SLOTS; i++)
+    {
+        slot = &q->slots[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) != COMBINE_PENDING)
+            continue;
+        combine_apply(q, &slot->op, recorder);
+        atomic_store_explicit(&slot->state, COMBINE_DONE, memory_order_release);
+    }
+}
+
+static CombineSlot *claim_slot(CombiningQueue *q)
+{
+    CombineSlot *slot;
+    bool owned;
+
+    if (combine_hint == 0)
+        combine_hint = atomic_fetch_add_explicit(&next_combine_hint, 1, memory_order_relaxed) + 1;
+    for (size_t i = 0; i < COMBINE_SLOTS; i++)
+    {
+        slot = &q->slots[(combine_hint - 1 + i) % COMBINE_SLOTS];
+        owned = false;
+        if (atomic_compare_exchange_strong_explicit(&slot->owned, &owned, true, memory_order_acquire, memory_order_relaxed))
+            return slot;
+    }
+    return NULL;
+}
+
+// returns true if we became the combiner, the plain load keeps a busy flag's line shared instead of bouncing it.
+static bool try_become_combiner(CombiningQueue *q)
+{
+    return !atomic_load_explicit(&q->combining, memory_order_relaxed) &&
+           !atomic_exchange_explicit(&q->combining, true, memory_order_acquire);
+}
+
+static void stop_combining(CombiningQueue *q)
+{
+    atomic_store_explicit(&q->combining, false, memory_order_release);
+}
+
+static void combine_backoff(unsigned int i)
+{
+    // the combiner may need our cpu.
+    if (i % COMBINE_YIELD_EVERY == 0)
+        thrd_yield();
+    else
+        cpu_relax();
+}
+
+// runs op through the combiner, returns once it was applied.
+static void combine_op(CombiningQueue *q, CombineOp *op)
+{
+    CombineSlot *slot = claim_slot(q);
+    SojournRecorder recorder;
+
+    // more threads than slots are busy, apply it ourselves.
+    if (slot == NULL)
+    {
+        for (unsigned int i = 1; !try_become_combiner(q); i++)
+            combine_backoff(i);
+        recorder = sojourn_recorder(&q->base);
+        combine_apply(q, op, &recorder);
+        combine(q, &recorder);
+        stop_combining(q);
+        return;
+    }
+
+    slot->op = *op;
+    atomic_store_explicit(&slot->state, COMBINE_PENDING, memory_order_release);
+    for (unsigned int i = 1; atomic_load_explicit(&slot->state, memory_order_acquire) != COMBINE_DONE; i++)
+    {
+        if (try_become_combiner(q))
+        {
+            recorder = sojourn_recorder(&q->base);
+            combine(q, &recorder);
+            stop_combining(q);
+        }
+        else
+        {
+            combine_backoff(i);
+        }
+    }
+    op->count = slot->op.count;
+    atomic_store_explicit(&slot->state, COMBINE_IDLE, memory_order_relaxed);
+    atomic_store_explicit(&slot->owned, false, memory_order_release);
+}
+
+static void combining_enqueue_many(QueueHandle *handle, void *const *items, size_t count)
+{
+    CombiningQueue *q = (CombiningQueue *)handle;
+    CombineOp op = {.enqueue = true, .in = items, .count = count};
+
+    if (count == 0)
+        return;
+    op.stamp = enqueue_stamp(handle);
+    combine_op(q, &op);
+    unpark(&q->lot, count);
+}
+
+static void combining_enqueue(QueueHandle *handle, void *data)
+{
+    combining_enqueue_many(handle, &data, 1);
+}
+
+static size_t combining_try_dequeue_many(QueueHandle *handle, void **items, size_t max)
+{
+    CombiningQueue *q = (CombiningQueue *)handle;
+    CombineOp op = {.enqueue = false, .out = items, .count = max};
+
+    if (max == 0 || counter_get(&q->size) == 0)
+        return 0;
+    combine_op(q, &op);
+    return op.count;
+}
+
+static bool combining_try_dequeue(QueueHandle *handle, void **item)
+{
+    return combining_try_dequeue_many(handle, item, 1) == 1;
+}
+
+static bool combining_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    return park_until(handle, &((CombiningQueue *)handle)->lot, combining_try_dequeue, item, deadline);
+}
+
+static void *combining_dequeue(QueueHandle *handle)
+{
+    return park_until_item(handle, &((CombiningQueue *)handle)->lot);
+}
+
+static size_t combining_size(QueueHandle *handle)
+{
+    return counter_get(&((CombiningQueue *)handle)->size);
+}
+static size_t combining_waiting(QueueHandle *handle)
+{
+    return atomic_load(&((CombiningQueue *)handle)->lot.waiting);
+}
+static size_t combining_visited(QueueHandle *handle)
+{
+    return counter_get(&((CombiningQueue *)handle)->visited);
+}
+
+static void combining_destroy(QueueHandle *handle)
+{
+    CombiningQueue *q = (CombiningQueue *)handle;
+    destroy_chunks(&q->items);
+    destroy_spares(&q->spares);
+    free(q);
+}
+
+static const QueueOps combining_ops = {
+    .enqueue = combining_enqueue,
+    .enqueue_many = combining_enqueue_many,
+    .dequeue = combining_dequeue,
+    .dequeue_timeout = combining_dequeue_timeout,
+    .try_dequeue = combining_try_dequeue,
+    .try_dequeue_many = combining_try_dequeue_many,
+    .size = combining_size,
+    .waiting = combining_waiting,
+    .visited = combining_visited,
+    .destroy = combining_destroy,
+};
+
+static QueueHandle *combining_create(const QueueOptions *options)
+{
+    CombiningQueue *q = (CombiningQueue *)aligned_alloc(_Alignof(CombiningQueue), sizeof(CombiningQueue));
+    if (q == NULL)
+        return NULL;
+    atomic_init(&q->combining, false);
+    init_spares(&q->spares, spare_chunks(options), options->latency_stats);
+    init_list(&q->items, &q->spares);
+    for (size_t i = 0; i < COMBINE_SLOTS; i++)
+    {
+        atomic_init(&q->slots[i].owned, false);
+        atomic_init(&q->slots[i].state, COMBINE_IDLE);
+    }
+    atomic_init(&q->size, 0);
+    atomic_init(&q->visited, 0);
+    init_parking_lot(&q->lot, false);
+    q->base.ops = &combining_ops;
+    return &q->base;
+}
+
+/* ### Multi Queue ### */
+// relaxed FIFO: k locked lists, enqueue appends to a random one and dequeue samples two random lists and takes from
+// the one whose oldest item was enqueued first. locks are only ever tried, a busy list is skipped for another sample,
+// so threads never queue up behind each other, and the items come out close to (but not exactly in) FIFO order.
+// next to its items every list keeps stamp runs (see Stamp Runs) and publishes the time of its oldest run for the sampling.
+// items enqueued within MULTI_RUN_NS of the newest run join it, so a busy list needs far fewer runs than items, at the price
+// of ordering the items of one run as if they came in together. latency stats use the same stamps.
+// tryDequeue only reports an empty queue after a sweep over all lists. consumers park on a parking lot.
+#define MULTI_EMPTY UINT64_MAX
+#define MULTI_SAMPLES 4
+#define MULTI_RUN_NS 1000
+
+typedef struct MultiList
+{
+    _Alignas(64) mtx_t lock;
+    Queue items;
+    ChunkSpares spares;
+    StampRuns runs;
+    // stamp of the oldest run (MULTI_EMPTY while empty), and the items the list holds and gave out.
+    // written under lock, read without it.
+    _Alignas(64) _Atomic uint64_t head_stamp;
+    atomic_size_t size;
+    atomic_size_t visited;
+} MultiList;
+
+typedef struct MultiQueue
+{
+    QueueHandle base;
+    size_t count;
+    MultiList *lists;
+    ParkingLot lot;
+} MultiQueue;
+
+static _Thread_local uint64_t multi_random;
+
+static MultiList *random_list(MultiQueue *q)
+{
+    // xorshift64, seeded differently in every thread.
+    if (multi_random == 0)
+        multi_random = (monotonic_ns() ^ (uint64_t)(uintptr_t)&multi_random) | 1;
+    multi_random ^= multi_random << 13;
+    multi_random ^= multi_random >> 7;
+    multi_random ^= multi_random << 17;
+    return &q->lists[multi_random % q->count];
+}
+
+// takes up to max items from list, must be called with its lock held.
+static size_t multi_take(QueueHandle *handle, MultiList *list, void **items, size_t max)
+{
+    size_t count = counter_get(&list->size) < max ? counter_get(&list->size) : max;
+    SojournRecorder recorder = sojourn_recorder(handle);
+
+    remove_items(&list->items, items, count, NULL);
+    take_runs(&list->runs, count, &recorder);
+    counter_sub(&list->size, count);
+    counter_add(&list->visited, count);
+    atomic_store_explicit(&list->head_stamp, oldest_stamp(&list->runs, MULTI_EMPTY), memory_order_relaxed);
+    return count;
+}
+
+static void multi_enqueue_many(QueueHandle *handle, void *const *items, size_t count)
+{
+    MultiQueue *q = (MultiQueue *)handle;
+    uint64_t stamp = monotonic_ns();
+    MultiList *list;
+    size_t tries = 0;
+
+    if (count == 0)
+        return;
+
+    // a busy list is skipped for another random one, only when all of those were busy too do we wait for the last.
+    do
+        list = random_list(q);
+    while (mtx_trylock(&list->lock) != thrd_success && ++tries < q->count);
+    if (tries == q->count)
+        mtx_lock(&list->lock);
+
+    append_items(items, count, 0, &list->items);
+    add_run(&list->runs, stamp, count, MULTI_RUN_NS);
+    if (list->runs.count == 1)
+        atomic_store_explicit(&list->head_stamp, oldest_stamp(&list->runs, MULTI_EMPTY), memory_order_relaxed);
+    counter_add(&list->size, count);
+    mtx_unlock(&list->lock);
+
+    unpark(&q->lot, count);
+}
+
+static void multi_enqueue(QueueHandle *handle, void *data)
+{
+    multi_enqueue_many(handle, &data, 1);
+}
+
+static size_t multi_try_dequeue_many(QueueHandle *handle, void **items, size_t max)
+{
+    MultiQueue *q = (MultiQueue *)handle;
+    MultiList *first;
+    MultiList *second;
+    MultiList *list;
+    size_t count;
+    bool busy;
+
+    if (max == 0)
+        return 0;
+
+    for (int i = 0; i < MULTI_SAMPLES; i++)
+    {
+        first = random_list(q);
+        second = random_list(q);
+        if (atomic_load_explicit(&second->head_stamp, memory_order_relaxed) <
+            atomic_load_explicit(&first->head_stamp, memory_order_relaxed))
+            first = second;
+        // both empty, the sweep below finds the remaining items faster than sampling.
+        if (atomic_load_explicit(&first->head_stamp, memory_order_relaxed) == MULTI_EMPTY)
+            break;
+        if (mtx_trylock(&first->lock) != thrd_success)
+            continue;
+        count = multi_take(handle, first, items, max);
+        mtx_unlock(&first->lock);
+        if (count > 0)
+            return count;
+    }
+
+    // only report an empty queue once every list was seen empty.
+    first = random_list(q);
+    do
+    {
+        busy = false;
+        for (size_t i = 0; i < q->count; i++)
+        {
+            list = &q->lists[(size_t)(first - q->lists + i) % q->count];
+            if (counter_get(&list->size) == 0)
+                continue;
+            if (mtx_trylock(&list->lock) != thrd_success)
+            {
+                busy = true;
+                continue;
+            }
+            count = multi_take(handle, list, items, max);
+            mtx_unlock(&list->lock);
+            if (count > 0)
+                return count;
+        }
+        if (busy)
+            thrd_yield();
+    } while (busy);
+    return 0;
+}
+
+static bool multi_try_dequeue(QueueHandle *handle, void **item)
+{
+    return multi_try_dequeue_many(handle, item, 1) == 1;
+}
+
+static bool multi_dequeue_timeout(QueueHandle *handle, void **item, const struct timespec *deadline)
+{
+    return park_until(handle, &((MultiQueue *)handle)->lot, multi_try_dequeue, item, deadline);
+}
+
+static void *multi_dequeue(QueueHandle *handle)
+{
+    return park_until_item(handle, &((MultiQueue *)handle)->lot);
+}
+
+static size_t multi_size(QueueHandle *handle)
+{
+    MultiQueue *q = (MultiQueue *)handle;
+    size_t size = 0;
+    for (size_t i = 0; i < q->count; i++)
+        size += counter_get(&q->lists[i].size);
+    return size;
+}
+static size_t multi_waiting(QueueHandle *handle)
+{
+    return atomic_load(&((MultiQueue *)handle)->lot.waiting);
+}
+static size_t multi_visited(QueueHandle *handle)
+{
+    MultiQueue *q = (MultiQueue *)handle;
+    size_t visited = 0;
+    for (size_t i = 0; i < q->count; i++)
+        visited += counter_get(&q->lists[i].visited);
+    return visited;
+}
+
+static void multi_destroy(QueueHandle *handle)
+{
+    MultiQueue *q = (MultiQueue *)handle;
+    for (size_t i = 0; i < q->count; i++)
+    {
+        destroy_chunks(&q->lists[i].items);
+        destroy_spares(&q->lists[i].spares);
+        destroy_runs(&q->lists[i].runs);
+        mtx_destroy(&q->lists[i].lock);
+    }
+    free(q->lists);
+    free(q);
+}
+
+static const QueueOps multi_ops = {
+    .enqueue = multi_enqueue,
+    .enqueue_many = multi_enqueue_many,
+    .dequeue = multi_dequeue,
+    .dequeue_timeout = multi_dequeue_timeout,
+    .try_dequeue = multi_try_dequeue,
+    .try_dequeue_many = multi_try_dequeue_many,
+    .size = multi_size,
+    .waiting = multi_waiting,
+    .visited = multi_visited,
+    .destroy = multi_destroy,
+};
+
+static QueueHandle *multi_create(const QueueOptions *options)
+{
+    MultiQueue *q = (MultiQueue *)aligned_alloc(_Alignof(MultiQueue), sizeof(MultiQueue));
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    // two lists per thread keep the chance that both samples are busy low.
+    size_t count = options->shards != 0 ? options->shards : 2 * (cpus > 0 ? (size_t)cpus : 1);
+    MultiList *lists = (MultiList *)aligned_alloc(_Alignof(MultiList), count * sizeof(MultiList));
+    size_t i;
+
+    if (q == NULL || lists == NULL)
+    {
+        free(q);
+        free(lists);
+        return NULL;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!init_runs(&lists[i].runs))
+            break;
+        if (mtx_init(&lists[i].lock, mtx_plain) != thrd_success)
+        {
+            destroy_runs(&lists[i].runs);
+            break;
+        }
+        // the spare chunks are split between the lists, which keep their stamps in runs.
+        init_spares(&lists[i].spares, spare_chunks(options) / count, false);
+        init_list(&lists[i].items, &lists[i].spares);
+        atomic_init(&lists[i].head_stamp, MULTI_EMPTY);
+        atomic_init(&lists[i].size, 0);
+        atomic_init(&lists[i].visited, 0);
+    }
+    if (i < count)
+    {
+        while (i > 0)
+        {
+            mtx_destroy(&lists[--i].lock);
+            destroy_runs(&lists[i].runs);
+        }
+        free(lists);
+        free(q);
+        return NULL;
+    }
+
+    q->count = count;
+    q->lists = lists;
+    init_parking_lot(&q->lot, false);
+    q->base.ops = &multi_ops;
+    return &q->base;
+}
+
+/* ### Latency Stats ### */
+// with QueueOptions.latency_stats every mode stores the enqueue time of an item next to it (see Item Stamps), so stats
+// add no allocation per item. sojourn (enqueue to dequeue) and wait (time a dequeue that found the queue empty had to
+// wait) are recorded into log bucketed histograms. every thread records into its own pair, found through a thread
+// specific key of the queue, so recording takes no lock and no read-modify-write, and queueStats merges them on read.
+// values below HIST_LINEAR ns get a bucket each, above that every power of two is split into 2^HIST_SUB_BITS buckets,
+// so a reported value is at most 12.5% off. values from 2^HIST_MAX_BITS ns (about 78 hours) on land in the last bucket.
+#define HIST_SUB_BITS 3
+#define HIST_LINEAR (2 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 48
+#define HIST_BUCKETS (HIST_LINEAR + (HIST_MAX_BITS - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS))
+_Static_assert(HIST_BUCKETS == QUEUE_LATENCY_BUCKETS, "QUEUE_LATENCY_BUCKETS has to match the histogram layout");
+
+typedef struct Histogram
+{
+    atomic_size_t buckets[HIST_BUCKETS];
+    atomic_size_t sum;
+    atomic_size_t min;
+    atomic_size_t max;
+} Histogram;
+
+typedef struct ThreadStats
+{
+    Histogram sojourn;
+    Histogram wait;
+    struct ThreadStats *next;
+} ThreadStats;
+
+typedef struct LatencyStats
+{
+    // protects threads, which only grows until the queue is destroyed.
+    mtx_t lock;
+    ThreadStats *threads;
+    // every thread's ThreadStats for this queue. a new key starts out NULL in every thread, so a thread never sees
+    // the histograms of a destroyed queue whose key was reused.
+    tss_t key;
+} LatencyStats;
+
+static size_t bucket_of(uint64_t ns)
+{
+    unsigned int bits;
+    if (ns < HIST_LINEAR)
+        return (size_t)ns;
+    if (ns >= (uint64_t)1 << HIST_MAX_BITS)
+        ns = ((uint64_t)1 << HIST_MAX_BITS) - 1;
+    bits = 63 - (unsigned int)__builtin_clzll(ns);
+    return HIST_LINEAR + (size_t)(bits - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS) +
+           (size_t)((ns >> (bits - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// the largest value that falls into bucket.
+static uint64_t bucket_top(size_t bucket)
+{
+    size_t k;
+    unsigned int shift;
+    if (bucket < HIST_LINEAR)
+        return bucket;
+    k = bucket - HIST_LINEAR;
+    shift = (unsigned int)(k >> HIST_SUB_BITS) + 1;
+    return ((((uint64_t)1 << HIST_SUB_BITS) + (k & ((1 << HIST_SUB_BITS) - 1)) + 1) << shift) - 1;
+}
+
+static void init_histogram(Histogram *h)
+{
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+        atomic_init(&h->buckets[i], 0);
+    atomic_init(&h->sum, 0);
+    atomic_init(&h->min, SIZE_MAX);
+    atomic_init(&h->max, 0);
+}
+
+// records count values of ns. only the owning thread records, so plain loads and stores are enough.
+static void record(Histogram *h, uint64_t ns, size_t count)
+{
+    counter_add(&h->buckets[bucket_of(ns)], count);
+    counter_add(&h->sum, ns * count);
+    if (ns < counter_get(&h->min))
+        atomic_store_explicit(&h->min, ns, memory_order_relaxed);
+    if (ns > counter_get(&h->max))
+        atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+}
+
+static LatencyStats *create_stats(void)
+{
+    LatencyStats *stats = (LatencyStats *)malloc(sizeof(LatencyStats));
+    if (stats == NULL)
+        return NULL;
+    if (mtx_init(&stats->lock, mtx_plain) != thrd_success)
+    {
+        free(stats);
+        return NULL;
+    }
+    // the histograms are freed with the queue, not when their thread exits.
+    if (tss_create(&stats->key, NULL) != thrd_success)
+    {
+        mtx_destroy(&stats->lock);
+        free(stats);
+        return NULL;
+    }
+    stats->threads = NULL;
+    return stats;
+}
+
+static void destroy_stats(LatencyStats *stats)
+{
+    ThreadStats *tmp;
+    while (stats->threads != NULL)
+    {
+        tmp = stats->threads;
+        stats->threads = tmp->next;
+        free(tmp);
+    }
+    tss_delete(stats->key);
+    mtx_destroy(&stats->lock);
+    free(stats);
+}
+
+// the calling thread's histograms, NULL only if they could not be allocated.
+static ThreadStats *thread_stats(LatencyStats *stats)
+{
+    ThreadStats *mine = tss_get(stats->key);
+    if (mine != NULL)
+        return mine;
+
+    mine = (ThreadStats *)malloc(sizeof(ThreadStats));
+    if (mine == NULL)
+        return NULL;
+    if (tss_set(stats->key, mine) != thrd_success)
+    {
+        free(mine);
+        return NULL;
+    }
+    init_histogram(&mine->sojourn);
+    init_histogram(&mine->wait);
+    mtx_lock(&stats->lock);
+    mine->next = stats->threads;
+    stats->threads = mine;
+    mtx_unlock(&stats->lock);
+    return mine;
+}
+
+static uint64_t enqueue_stamp(QueueHandle *q)
+{
+    return q->stats == NULL ? 0 : monotonic_ns();
+}
+
+static SojournRecorder sojourn_recorder(QueueHandle *q)
+{
+    SojournRecorder recorder = {NULL, 0};
+    ThreadStats *mine;
+    if (q->stats == NULL || (mine = thread_stats(q->stats)) == NULL)
+        return recorder;
+    recorder.histogram = &mine->sojourn;
+    recorder.now = monotonic_ns();
+    return recorder;
+}
+
+static void record_sojourn(const SojournRecorder *recorder, uint64_t stamp, size_t count)
+{
+    if (recorder->histogram == NULL)
+        return;
+    // stamps taken by another thread may be a little ahead of our clock read.
+    record(recorder->histogram, recorder->now > stamp ? recorder->now - stamp : 0, count);
+}
+
+static void record_wait(QueueHandle *q, uint64_t waited)
+{
+    ThreadStats *mine;
+    if (q->stats == NULL)
+        return;
+    mine = thread_stats(q->stats);
+    if (mine != NULL)
+        record(&mine->wait, waited, 1);
+}
+
+static void summarize(size_t *buckets, uint64_t sum, uint64_t min, uint64_t max, QueueLatency *out)
+{
+    // reported percentiles are the top of their bucket, but never above the largest value seen.
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    uint64_t *targets[] = {&out->p50, &out->p90, &out->p99, &out->p999};
+    uint64_t count = 0;
+    uint64_t seen = 0;
+    size_t bucket = 0;
+
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+        count += buckets[i];
+    memset(out, 0, sizeof(*out));
+    if (count == 0)
+        return;
+
+    out->count = count;
+    out->min = min;
+    out->max = max;
+    out->mean = sum / count;
+    for (int q = 0; q < 4; q++)
+    {
+        uint64_t rank = (uint64_t)(quantiles[q] * (double)count);
+        if (rank == 0)
+            rank = 1;
+        while (seen + buckets[bucket] < rank)
+            seen += buckets[bucket++];
+        *targets[q] = bucket_top(bucket) < max ? bucket_top(bucket) : max;
+    }
+}
+
+static void merge_stats(LatencyStats *stats, QueueStats *out)
+{
+    size_t sojourn[HIST_BUCKETS] = {0};
+    size_t wait[HIST_BUCKETS] = {0};
+    uint64_t sojourn_sum = 0, wait_sum = 0;
+    uint64_t sojourn_min = UINT64_MAX, wait_min = UINT64_MAX;
+    uint64_t sojourn_max = 0, wait_max = 0;
+    uint64_t v;
+
+    mtx_lock(&stats->lock);
+    for (ThreadStats *t = stats->threads; t != NULL; t = t->next)
+    {
+        for (size_t i = 0; i < HIST_BUCKETS; i++)
+        {
+            sojourn[i] += counter_get(&t->sojourn.buckets[i]);
+            wait[i] += counter_get(&t->wait.buckets[i]);
+        }
+        sojourn_sum += counter_get(&t->sojourn.sum);
+        wait_sum += counter_get(&t->wait.sum);
+        v = counter_get(&t->sojourn.min);
+        sojourn_min = v < sojourn_min ? v : sojourn_min;
+        v = counter_get(&t->wait.min);
+        wait_min = v < wait_min ? v : wait_min;
+        v = counter_get(&t->sojourn.max);
+        sojourn_max = v > sojourn_max ? v : sojourn_max;
+        v = counter_get(&t->wait.max);
+        wait_max = v > wait_max ? v : wait_max;
+    }
+    mtx_unlock(&stats->lock);
+
+    summarize(sojourn, sojourn_sum, sojourn_min, sojourn_max, &out->sojourn);
+    summarize(wait, wait_sum, wait_min, wait_max, &out->wait);
+}
+
+/* ### Readiness Fd ### */
+// with the event_fd option the queue owns an eventfd that event loops can poll instead of blocking in dequeue.
+// an enqueue only writes to it while the queue is armed, and the queue is armed while its consumers know it is empty:
+// after creation and whenever tryDequeue or tryDequeueMany comes back empty. a burst of enqueues costs one write,
+// not one per item, and a consumer that drains until tryDequeue fails is signalled again for the next item.
+// arming clears the fd itself (consumers never need to read it) and then checks the size again in case an enqueue
+// came in between the empty try and the arming, the fences make sure one of the two sides sees the other.
+
+// -1 on systems without eventfd, queues can not be created with event_fd there.
+static int open_event_fd(void)
+{
+#ifdef __linux__
+    return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
+static void notify_ready(QueueHandle *q)
+{
+    uint64_t one = 1;
+    ssize_t written;
+    if (q->event_fd < 0)
+        return;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&q->event_armed, memory_order_relaxed) && atomic_exchange(&q->event_armed, false))
+    {
+        // can only fail if the counter is about to overflow, and then the fd is readable anyway.
+        written = write(q->event_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+static void arm_ready(QueueHandle *q)
+{
+    uint64_t count;
+    ssize_t taken;
+    if (q->event_fd < 0 || atomic_load_explicit(&q->event_armed, memory_order_relaxed))
+        return;
+
+    // non blocking, fails with EAGAIN if nothing was signalled.
+    taken = read(q->event_fd, &count, sizeof(count));
+    (void)taken;
+    atomic_store(&q->event_armed, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (q->ops->size(q) > 0)
+        notify_ready(q);
+}
+
+/* ### Adaptive Spinning ### */
+// parking and waking costs a few microseconds in the kernel on both sides, so a blocking dequeue that finds the queue empty
+// first spins on tryDequeue, but only as long as items recently showed up that quickly. a consumer that starts to wait
+// leaves its start time in wait_start, and the next enqueue feeds the time since then into a moving average per queue.
+// spinning lasts up to twice that average and is skipped completely while the average is above SPIN_LIMIT_NS
+// (a slow producer or an idle queue), so consumers go to sleep right away then.
+// while nobody waits there is nothing to learn, and an enqueue only loads wait_start.
+#define SPIN_LIMIT_NS 50000
+// initial guess, spin a little until the queue has told us something.
+#define SPIN_INITIAL_NS (SPIN_LIMIT_NS / 4)
+#define SPIN_YIELD_EVERY 64
+
+static bool spin_for_item(QueueHandle *q, void **item, uint64_t start)
+{
+    uint64_t budget = 2 * (uint64_t)atomic_load_explicit(&q->arrival_estimate, memory_order_relaxed);
+    if (budget > 2 * SPIN_LIMIT_NS)
+        return false;
+
+    for (unsigned int i = 1; monotonic_ns() - start < budget; i++)
+    {
+        // the producer we are waiting for may need our cpu.
+        if (i % SPIN_YIELD_EVERY == 0)
+            thrd_yield();
+        else
+            cpu_relax();
+        if (q->ops->try_dequeue(q, item))
+            return true;
+    }
+    return false;
+}
+
+// called by every enqueue after adding its items.
+static void learn_arrival(QueueHandle *q)
+{
+    uint64_t start;
+    uint64_t gap;
+    unsigned int estimate;
+    // an enqueue racing with a consumer that just started to wait may miss it, that only costs one sample.
+    if (atomic_load_explicit(&q->wait_start, memory_order_relaxed) == 0)
+        return;
+    // only one of several enqueues racing here takes the sample.
+    start = atomic_exchange_explicit(&q->wait_start, 0, memory_order_relaxed);
+    if (start == 0)
+        return;
+
+    gap = monotonic_ns() - start;
+    // the consumer's clock read may be a little ahead of ours.
+    if ((int64_t)gap < 0)
+        gap = 0;
+    estimate = atomic_load_explicit(&q->arrival_estimate, memory_order_relaxed);
+    // a long gap only has to show that spinning does not pay off, capping it lets the average recover quickly.
+    if (gap > 4 * SPIN_LIMIT_NS)
+        gap = 4 * SPIN_LIMIT_NS;
+    // weight 1/8 for the new sample, two producers updating at once just lose one sample.
+    atomic_store_explicit(&q->arrival_estimate, estimate - estimate / 8 + (unsigned int)gap / 8, memory_order_relaxed);
+}
+
+// tryDequeue, then spinning, then the mode's blocking dequeue. returns false if deadline (NULL waits forever) passed first.
+static bool dequeue_blocking(QueueHandle *q, void **item, const struct timespec *deadline)
+{
+    uint64_t start;
+    uint64_t sampled;
+    uint64_t waited;
+    bool found = true;
+
+    if (q->ops->try_dequeue(q, item))
+        return true;
+
+    start = monotonic_ns();
+    atomic_store_explicit(&q->wait_start, start, memory_order_relaxed);
+    if (!spin_for_item(q, item, start))
+    {
+        if (deadline == NULL)
+            *item = q->ops->dequeue(q);
+        else
+            found = q->ops->dequeue_timeout(q, item, deadline);
+    }
+    // an item enqueued before our start ended the wait (or none came), a later enqueue must not time it from our start.
+    sampled = start;
+    atomic_compare_exchange_strong_explicit(&q->wait_start, &sampled, 0, memory_order_relaxed, memory_order_relaxed);
+    waited = monotonic_ns() - start;
+    if (found)
+        record_wait(q, waited);
+    return found;
+}
+
+/* ############## -Code Start- ############## */
+
+QueueHandle *queueCreate(void)
+{
+    return queueCreateWithOptions(NULL);
+}
+
+QueueHandle *queueCreateWithOptions(const QueueOptions *options)
+{
+    // a zeroed QueueOptions (or NULL) selects the defaults.
+    QueueOptions defaults = {0};
+    QueueHandle *q;
+    if (options == NULL)
+        options = &defaults;
+
+    switch (options->mode)
+    {
+    case QUEUE_MODE_LOCKED:
+        q = locked_create(options);
+        break;
+    case QUEUE_MODE_TWO_LOCK:
+        q = two_lock_create(options);
+        break;
+    case QUEUE_MODE_LOCK_FREE:
+        q = lock_free_create();
+        break;
+    case QUEUE_MODE_RING:
+        q = ring_create(options);
+        break;
+    case QUEUE_MODE_SHARDED:
+        q = sharded_create(options);
+        break;
+    case QUEUE_MODE_SPSC:
+        q = spsc_create(options);
+        break;
+    case QUEUE_MODE_INTRUSIVE:
+        q = intrusive_create(options);
+        break;
+    case QUEUE_MODE_COMBINING:
+        q = combining_create(options);
+        break;
+    case QUEUE_MODE_MULTI:
+        q = multi_create(options);
+        break;
+    default:
+        return NULL;
+    }
+
+    if (q == NULL)
+        return NULL;
+
+    q->mode = options->mode;
+    atomic_init(&q->arrival_estimate, SPIN_INITIAL_NS);
+    atomic_init(&q->wait_start, 0);
+    q->stats = NULL;
+    q->event_fd = -1;
+    atomic_init(&q->event_armed, true);
+    if (options->latency_stats && (q->stats = create_stats()) == NULL)
+    {
+        q->ops->destroy(q);
+        return NULL;
+    }
+    if (options->event_fd && (q->event_fd = open_event_fd()) < 0)
+    {
+        if (q->stats != NULL)
+            destroy_stats(q->stats);
+        q->ops->destroy(q);
+        return NULL;
+    }
+    return q;
+}
+
+void queueDestroy(QueueHandle *q)
+{
+    if (q->stats != NULL)
+        destroy_stats(q->stats);
+    if (q->event_fd >= 0)
+        close(q->event_fd);
+    q->ops->destroy(q);
+    return;
+}
+
+void queueEnqueue(QueueHandle *q, void *data)
+{
+    q->ops->enqueue(q, data);
+    learn_arrival(q);
+    notify_ready(q);
+}
+
+void queueEnqueuePriority(QueueHandle *q, void *data, unsigned int priority)
+{
+    if (q->ops->enqueue_priority == NULL)
+    {
+        q->ops->enqueue(q, data);
+    }
+    else
+    {
+        if (priority >= QUEUE_PRIORITY_LANES)
+            priority = QUEUE_PRIORITY_LANES - 1;
+        q->ops->enqueue_priority(q, data, priority);
+    }
+    learn_arrival(q);
+    notify_ready(q);
+}
+
+bool queueTryEnqueue(QueueHandle *q, void *data)
+{
+    if (q->ops->try_enqueue == NULL)
+        q->ops->enqueue(q, data);
+    else if (!q->ops->try_enqueue(q, data))
+        return false;
+    learn_arrival(q);
+    notify_ready(q);
+    return true;
+}
+
+void queueEnqueueMany(QueueHandle *q, void *const *items, size_t count)
+{
+    if (q->ops->enqueue_many == NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+            q->ops->enqueue(q, items[i]);
+    }
+    else
+    {
+        q->ops->enqueue_many(q, items, count);
+    }
+    if (count > 0)
+    {
+        learn_arrival(q);
+        notify_ready(q);
+    }
+}
+
+void *queueDequeue(QueueHandle *q)
+{
+    void *data;
+    dequeue_blocking(q, &data, NULL);
+    return data;
+}
+
+bool queueDequeueTimeout(QueueHandle *q, void **item, const struct timespec *deadline)
+{
+    return dequeue_blocking(q, item, deadline);
+}
+
+bool queueTryDequeue(QueueHandle *q, void **item)
+{
+    if (!q->ops->try_dequeue(q, item))
+    {
+        arm_ready(q);
+        return false;
+    }
+    return true;
+}
+
+size_t queueTryDequeueMany(QueueHandle *q, void **items, size_t max)
+{
+    size_t count = 0;
+    if (q->ops->try_dequeue_many != NULL)
+        count = q->ops->try_dequeue_many(q, items, max);
+    else
+        while (count < max && q->ops->try_dequeue(q, &items[count]))
+            count++;
+    if (count == 0)
+        arm_ready(q);
+    return count;
+}
+
+size_t queueDequeueMany(QueueHandle *q, void **items, size_t max)
+{
+    size_t count;
+    if (max == 0)
+        return 0;
+
+    count = queueTryDequeueMany(q, items, max);
+    if (count > 0)
+        return count;
+
+    // nothing there, block for the first item and take whatever arrived with it.
+    items[0] = queueDequeue(q);
+    return 1 + queueTryDequeueMany(q, items + 1, max - 1);
+}
+
+bool queueStats(QueueHandle *q, QueueStats *stats)
+{
+    if (q->stats == NULL)
+        return false;
+    merge_stats(q->stats, stats);
+    return true;
+}
+
+size_t queueLatencyBucket(uint64_t ns)
+{
+    return bucket_of(ns);
+}
+
+uint64_t queueLatencyBucketTop(size_t bucket)
+{
+    return bucket_top(bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1);
+}
+
+int queueEventFd(QueueHandle *q)
+{
+    return q->event_fd;
+}
+
+bool queueLockStats(QueueHandle *q, QueueLockStats *stats)
+{
+    if (q->ops->lock_stats == NULL)
+        return false;
+    q->ops->lock_stats(q, stats);
+    return true;
+}
+
+QueueMode queueMode(QueueHandle *q)
+{
+    return q->mode;
+}
+
+size_t queueSize(QueueHandle *q)
+{
+    return q->ops->size(q);
+}
+size_t queueWaiting(QueueHandle *q)
+{
+    return q->ops->waiting(q);
+}
+size_t queueVisited(QueueHandle *q)
+{
+    return q->ops->visited(q);
+}
+
+/* ### Default Queue ### */
+// the original global API is kept for compatibility, it simply operates on a process wide default instance.
+static QueueHandle *default_queue;
+
+void initQueue(void)
+{
+    default_queue = queueCreate();
+}
+
+void destroyQueue(void)
+{
+    queueDestroy(default_queue);
+    default_queue = NULL;
+    return;
+}
+
+void enqueue(void *data)
+{
+    queueEnqueue(default_queue, data);
+}
+
+void enqueueMany(void *const *items, size_t count)
+{
+    queueEnqueueMany(default_queue, items, count);
+}
+
+void enqueuePriority(void *data, unsigned int priority)
+{
+    queueEnqueuePriority(default_queue, data, priority);
+}
+
+bool tryEnqueue(void *data)
+{
+    return queueTryEnqueue(default_queue, data);
+}
+
+void *dequeue(void)
+{
+    return queueDequeue(default_queue);
+}
+
+bool tryDequeue(void **item)
+{
+    return queueTryDequeue(default_queue, item);
+}
+
+bool dequeueTimeout(void **item, const struct timespec *deadline)
+{
+    return queueDequeueTimeout(default_queue, item, deadline);
+}
+
+size_t dequeueMany(void **items, size_t max)
+{
+    return queueDequeueMany(default_queue, items, max);
+}
+
+size_t tryDequeueMany(void **items, size_t max)
+{
+    return queueTryDequeueMany(default_queue, items, max);
+}
+
+size_t size(void)
+{
+    return queueSize(default_queue);
+}
+size_t waiting(void)
+{
+    return queueWaiting(default_queue);
+}
+size_t visited(void)
+{
+    return queueVisited(default_queue);
+}
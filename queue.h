@@ -1,11 +1,165 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <time.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
 void initQueue(void);
 void destroyQueue(void);
 void enqueue(void*);
+void enqueueMany(void* const*, size_t);
+void enqueuePriority(void*, unsigned int);
+bool tryEnqueue(void*);
 void* dequeue(void);
 bool tryDequeue(void**);
+bool dequeueTimeout(void**, const struct timespec*);
+size_t dequeueMany(void**, size_t);
+size_t tryDequeueMany(void**, size_t);
 size_t size(void);
 size_t waiting(void);
 size_t visited(void);
+
+// handle based API, every handle is an independent queue with its own lock.
+typedef struct QueueHandle QueueHandle;
+
+typedef enum QueueMode
+{
+    QUEUE_MODE_LOCKED = 0, // one lock for enqueue and dequeue (default)
+    QUEUE_MODE_TWO_LOCK,   // separate head and tail locks, producers and consumers only meet on an empty queue
+    QUEUE_MODE_LOCK_FREE,  // Michael-Scott CAS queue with hazard pointers, dequeue only blocks when the queue is empty
+    QUEUE_MODE_RING,       // bounded array ring, enqueue blocks (and tryEnqueue fails) while the ring is full
+    QUEUE_MODE_SHARDED,    // per thread sub-queues with work stealing, FIFO only per producer
+    QUEUE_MODE_SPSC,       // bounded ring for exactly one producer and one consumer thread, wait free tryEnqueue/tryDequeue
+    QUEUE_MODE_INTRUSIVE,  // items are QueueLinks embedded in the caller's structures, enqueue and dequeue never allocate
+    QUEUE_MODE_COMBINING,  // flat combining, one thread applies the operations all waiting threads published, for heavy contention
+    QUEUE_MODE_MULTI,      // relaxed FIFO over random locked lists, dequeue takes the older head of two sampled lists
+} QueueMode;
+
+// the link of QUEUE_MODE_INTRUSIVE: embed one in every item and enqueue its address, dequeue returns that address.
+// the queue owns next while the item is queued. an item can be in one intrusive queue at a time per link.
+typedef struct QueueLink
+{
+    struct QueueLink *next;
+} QueueLink;
+
+// the item of type that embeds link as member.
+#define QUEUE_LINK_ITEM(link, type, member) ((type *)((char *)(link) - offsetof(type, member)))
+
+// which blocked consumer an enqueue wakes. the policy applies to the modes that keep their own waiter list
+// (QUEUE_MODE_LOCKED, QUEUE_MODE_TWO_LOCK and QUEUE_MODE_INTRUSIVE), the others leave the choice to the kernel.
+typedef enum QueueWakePolicy
+{
+    QUEUE_WAKE_FIFO = 0, // the consumer that waited longest (default)
+    QUEUE_WAKE_LIFO,     // the consumer that parked last, its cache is still warm and idle consumers stay asleep
+} QueueWakePolicy;
+
+// a zero initialized QueueOptions selects the default for every field.
+typedef struct QueueOptions
+{
+    QueueMode mode;
+    // number of slots of QUEUE_MODE_RING and QUEUE_MODE_SPSC, rounded up to a power of two (0 means 1024).
+    size_t capacity;
+    // free item slots (in whole chunks) the locked and combining modes keep, and free nodes the node pool of the
+    // two lock mode keeps, before returning memory to the system (0 means 4096).
+    size_t pool_high_watermark;
+    // number of sub-queues of QUEUE_MODE_SHARDED (0 means one per online cpu) and of QUEUE_MODE_MULTI (0 means two per cpu).
+    size_t shards;
+    // spread the shards of QUEUE_MODE_SHARDED over the NUMA nodes (shards is rounded up to a multiple of the node count),
+    // threads use a shard of their own node and steal from remote nodes last. a no-op on machines with one node.
+    bool numa;
+    // timestamp items at enqueue and keep latency histograms for queueStats. the time is stored next to the item, which costs
+    // a clock read per enqueue and per dequeue and one thread specific storage key per queue, queueCreateWithOptions returns
+    // NULL once the process runs out of them. QUEUE_MODE_MULTI stamps runs of items enqueued within a microsecond.
+    bool latency_stats;
+    // create an eventfd for queueEventFd, so event loops can wait for items with epoll/poll instead of dequeue.
+    // Linux only, elsewhere queueCreateWithOptions returns NULL with this set.
+    bool event_fd;
+    QueueWakePolicy wake_policy;
+} QueueOptions;
+
+// latencies in nanoseconds, the percentiles are at most 12.5% above the exact value.
+typedef struct QueueLatency
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t mean;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+} QueueLatency;
+
+// the buckets behind QueueLatency, for callers that keep histograms of their own with the same resolution:
+// values below 16ns get a bucket each, above that every power of two is split into 8 buckets, up to 2^48 ns.
+#define QUEUE_LATENCY_BUCKETS 368
+
+typedef struct QueueStats
+{
+    // enqueue to dequeue of every dequeued item (items handed to a blocked consumer included).
+    QueueLatency sojourn;
+    // how long dequeues that found the queue empty waited for their item.
+    QueueLatency wait;
+} QueueStats;
+
+// lock profile of QUEUE_MODE_LOCKED, collected only when queue.c is compiled with -DQUEUE_PROFILE_LOCKS.
+typedef struct QueueLockOpStats
+{
+    uint64_t acquisitions;
+    // acquisitions that found queue_lock taken and had to wait for it.
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t hold_ns;
+} QueueLockOpStats;
+
+typedef struct QueueLockStats
+{
+    // enqueue, enqueueMany and enqueuePriority.
+    QueueLockOpStats enqueue;
+    // dequeue, dequeueTimeout and the blocking part of dequeueMany.
+    QueueLockOpStats dequeue;
+    // tryDequeue and tryDequeueMany (dequeue starts with a tryDequeue too).
+    QueueLockOpStats try_dequeue;
+    // dequeues that had to park, and enqueues that handed their item to a parked dequeue.
+    uint64_t parks;
+    uint64_t wakes;
+} QueueLockStats;
+
+QueueHandle* queueCreate(void);
+QueueHandle* queueCreateWithOptions(const QueueOptions*);
+QueueMode queueMode(QueueHandle*);
+void queueDestroy(QueueHandle*);
+void queueEnqueue(QueueHandle*, void*);
+// enqueues the items in order, blocked consumers are served first (the waiter woken first gets the first item).
+void queueEnqueueMany(QueueHandle*, void* const*, size_t);
+// priorities run from 0 (what queueEnqueue uses) to QUEUE_PRIORITY_LANES - 1, higher ones are clamped.
+// dequeue returns the oldest item of the highest priority, modes other than QUEUE_MODE_LOCKED ignore the priority.
+#define QUEUE_PRIORITY_LANES 8
+void queueEnqueuePriority(QueueHandle*, void*, unsigned int);
+// only a bounded queue can refuse an item, returns false if it is full.
+bool queueTryEnqueue(QueueHandle*, void*);
+void* queueDequeue(QueueHandle*);
+bool queueTryDequeue(QueueHandle*, void**);
+// like queueDequeue, but returns false once deadline (an absolute TIME_UTC time, as for cnd_timedwait) passed without an item.
+bool queueDequeueTimeout(QueueHandle*, void**, const struct timespec*);
+// take up to max items in FIFO order and return how many were taken, dequeueMany blocks until there is at least one.
+size_t queueDequeueMany(QueueHandle*, void**, size_t);
+size_t queueTryDequeueMany(QueueHandle*, void**, size_t);
+size_t queueSize(QueueHandle*);
+size_t queueWaiting(QueueHandle*);
+size_t queueVisited(QueueHandle*);
+// merges the histograms of all threads, returns false if the queue was not created with latency_stats.
+bool queueStats(QueueHandle*, QueueStats*);
+// the bucket (below QUEUE_LATENCY_BUCKETS) a latency in nanoseconds falls into, and the largest value of a bucket.
+size_t queueLatencyBucket(uint64_t);
+uint64_t queueLatencyBucketTop(size_t);
+// the fd becomes readable when an item arrives while the queue is empty, at most once until the next tryDequeue or
+// tryDequeueMany finds the queue empty again (which also clears it). -1 if the queue was created without event_fd.
+// drain with tryDequeue until it fails before waiting on the fd again, the queue owns the fd and closes it on destroy.
+int queueEventFd(QueueHandle*);
+// returns false if the mode has no lock profile or queue.c was compiled without QUEUE_PROFILE_LOCKS.
+bool queueLockStats(QueueHandle*, QueueLockStats*);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,295 @@
+#pragma once
+// type safe C++17 wrapper over the queue handle API, header only.
+// Queue<T> owns its items: enqueue moves (or constructs) them into the queue, dequeue moves them out,
+// and whatever is left in the queue when it is destroyed is destroyed with it.
+//
+// the queue itself only stores a pointer per item. a T that fits into a pointer and is trivially copyable
+// (ints, small enums, raw pointers, ...) is stored right in that pointer slot, no allocation at all.
+// any other T lives in a box. the thread that takes an item out pushes its box onto a lock free spare stack of the
+// queue, and an enqueuing thread that runs out of boxes takes that whole stack at once onto a free list of its own
+// (shared by all queues of the same T). so boxes flow back from the consumers to the producers, and neither side
+// allocates in steady state, not even a thread that only produces.
+// QUEUE_MODE_INTRUSIVE can not be used here, its items have to be QueueLinks.
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "queue.h"
+
+template <typename T>
+class Queue
+{
+public:
+    // boxes of dequeued items every queue and every thread keeps for reuse.
+    static constexpr size_t SpareBoxes = 1024;
+
+    explicit Queue(const QueueOptions &options = QueueOptions{}) : handle_(queueCreateWithOptions(&options))
+    {
+        if (handle_ == nullptr)
+            throw std::bad_alloc();
+    }
+
+    ~Queue()
+    {
+        if (handle_ == nullptr)
+            return;
+        void *slot;
+        while (queueTryDequeue(handle_, &slot))
+            destroy(slot);
+        queueDestroy(handle_);
+        release_spares(spare_head_.load(std::memory_order_acquire));
+    }
+
+    Queue(const Queue &) = delete;
+    Queue &operator=(const Queue &) = delete;
+
+    Queue(Queue &&other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)),
+          spare_head_(other.spare_head_.exchange(nullptr, std::memory_order_relaxed)),
+          spare_count_(other.spare_count_.exchange(0, std::memory_order_relaxed))
+    {
+    }
+
+    Queue &operator=(Queue &&other) noexcept
+    {
+        std::swap(handle_, other.handle_);
+        void *head = spare_head_.load(std::memory_order_relaxed);
+        size_t count = spare_count_.load(std::memory_order_relaxed);
+        spare_head_.store(other.spare_head_.exchange(head, std::memory_order_relaxed), std::memory_order_relaxed);
+        spare_count_.store(other.spare_count_.exchange(count, std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void enqueue(const T &item)
+    {
+        emplace(item);
+    }
+
+    void enqueue(T &&item)
+    {
+        emplace(std::move(item));
+    }
+
+    template <typename... Args>
+    void emplace(Args &&...args)
+    {
+        queueEnqueue(handle_, make_slot(std::forward<Args>(args)...));
+    }
+
+    // see queueEnqueuePriority.
+    template <typename... Args>
+    void emplacePriority(unsigned int priority, Args &&...args)
+    {
+        queueEnqueuePriority(handle_, make_slot(std::forward<Args>(args)...), priority);
+    }
+
+    // only a bounded queue can refuse an item, item is only moved from if it was enqueued.
+    bool tryEnqueue(T &item)
+    {
+        void *slot = make_slot(std::move(item));
+        if (queueTryEnqueue(handle_, slot))
+            return true;
+        item = take(slot);
+        return false;
+    }
+
+    T dequeue()
+    {
+        return take(queueDequeue(handle_));
+    }
+
+    bool tryDequeue(T &item)
+    {
+        void *slot;
+        if (!queueTryDequeue(handle_, &slot))
+            return false;
+        item = take(slot);
+        return true;
+    }
+
+    // see queueDequeueTimeout, deadline is an absolute TIME_UTC time.
+    bool dequeueTimeout(T &item, const struct timespec &deadline)
+    {
+        void *slot;
+        if (!queueDequeueTimeout(handle_, &slot, &deadline))
+            return false;
+        item = take(slot);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return queueSize(handle_);
+    }
+    size_t waiting() const
+    {
+        return queueWaiting(handle_);
+    }
+    size_t visited() const
+    {
+        return queueVisited(handle_);
+    }
+
+    // the underlying handle, for queueStats, queueEventFd and the like. its items must only be taken through this Queue.
+    QueueHandle *handle() const
+    {
+        return handle_;
+    }
+
+private:
+    static constexpr bool Inline = sizeof(T) <= sizeof(void *) && std::is_trivially_copyable_v<T>;
+    // a spare box holds the link to the next spare box instead of a T.
+    static constexpr size_t BoxSize = sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *);
+    static constexpr size_t BoxAlign = alignof(T) > alignof(void *) ? alignof(T) : alignof(void *);
+
+    struct SpareList
+    {
+        void *head = nullptr;
+        size_t count = 0;
+
+        ~SpareList()
+        {
+            while (head != nullptr)
+                release_box(pop());
+        }
+
+        void push(void *box)
+        {
+            head = new (box) void *(head);
+            count++;
+        }
+
+        void *pop()
+        {
+            void *box = head;
+            head = *std::launder(static_cast<void **>(box));
+            count--;
+            return box;
+        }
+    };
+
+    QueueHandle *handle_;
+    // boxes given back by dequeuing threads. they only push single boxes and enqueuing threads only take the whole
+    // stack, so there is no ABA. spare_count_ bounds it, it is only an estimate while boxes are in flight.
+    std::atomic<void *> spare_head_{nullptr};
+    std::atomic<size_t> spare_count_{0};
+
+    static SpareList &spares()
+    {
+        static thread_local SpareList list;
+        return list;
+    }
+
+    template <typename... Args>
+    void *make_slot(Args &&...args)
+    {
+        if constexpr (Inline)
+        {
+            T item(std::forward<Args>(args)...);
+            void *slot = nullptr;
+            std::memcpy(&slot, &item, sizeof(T));
+            return slot;
+        }
+        else
+        {
+            SpareList &list = spares();
+            if (list.head == nullptr)
+                take_spares(list);
+            void *box = list.head != nullptr ? list.pop() : ::operator new(BoxSize, std::align_val_t(BoxAlign));
+            try
+            {
+                return new (box) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                recycle_box(box);
+                throw;
+            }
+        }
+    }
+
+    // moves the item out of slot and gives its box back.
+    T take(void *slot)
+    {
+        if constexpr (Inline)
+        {
+            alignas(T) unsigned char bytes[sizeof(T)];
+            std::memcpy(bytes, &slot, sizeof(T));
+            return *std::launder(reinterpret_cast<T *>(bytes));
+        }
+        else
+        {
+            T *boxed = static_cast<T *>(slot);
+            T item(std::move(*boxed));
+            boxed->~T();
+            give_back_box(boxed);
+            return item;
+        }
+    }
+
+    void destroy(void *slot)
+    {
+        if constexpr (!Inline)
+        {
+            static_cast<T *>(slot)->~T();
+            release_box(slot);
+        }
+    }
+
+    static void recycle_box(void *box)
+    {
+        SpareList &list = spares();
+        if (list.count < SpareBoxes)
+            list.push(box);
+        else
+            release_box(box);
+    }
+
+    // hands box to the enqueuing side of this queue.
+    void give_back_box(void *box)
+    {
+        if (spare_count_.fetch_add(1, std::memory_order_relaxed) >= SpareBoxes)
+        {
+            spare_count_.fetch_sub(1, std::memory_order_relaxed);
+            release_box(box);
+            return;
+        }
+        void *next = spare_head_.load(std::memory_order_relaxed);
+        do
+            new (box) void *(next);
+        while (!spare_head_.compare_exchange_weak(next, box, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // moves the boxes dequeuing threads gave back to this queue onto the empty list of the calling thread.
+    void take_spares(SpareList &list)
+    {
+        if (spare_head_.load(std::memory_order_relaxed) == nullptr)
+            return;
+        void *box = spare_head_.exchange(nullptr, std::memory_order_acquire);
+        size_t taken = 0;
+        while (box != nullptr)
+        {
+            void *next = *std::launder(static_cast<void **>(box));
+            recycle_box(box);
+            box = next;
+            taken++;
+        }
+        spare_count_.fetch_sub(taken, std::memory_order_relaxed);
+    }
+
+    static void release_spares(void *box)
+    {
+        while (box != nullptr)
+        {
+            void *next = *std::launder(static_cast<void **>(box));
+            release_box(box);
+            box = next;
+        }
+    }
+
+    static void release_box(void *box)
+    {
+        ::operator delete(box, std::align_val_t(BoxAlign));
+    }
+};
@@ -533,6 +533,49 @@ void test_mixed_operations()
     printf("mixed operations test passed.\n");
 }
 
+int spsc_consumer(void *arg)
+{
+    QueueHandle *q = arg;
+    long sum = 0;
+    for (long i = 1; i <= 100000; i++)
+        sum += (long)queueDequeue(q);
+    return sum == 100000L * 100001 / 2;
+}
+
+void test_spsc_asymmetric_lots()
+{
+    printf("=== Testing SPSC parking lots ===\n");
+
+    QueueOptions options = {.mode = QUEUE_MODE_SPSC, .capacity = 2};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    assert(q != NULL);
+    SpscQueue *spsc = (SpscQueue *)q;
+
+    // both lots must be asymmetric wherever the kernel offers private expedited membarriers.
+    bool supported = false;
+#ifdef SYS_membarrier
+    long commands = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    supported = commands >= 0 && (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+                (commands & MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED);
+#endif
+    printf("membarrier supported: %d, asymmetric lots: %d %d\n", supported, spsc->readers.asymmetric, spsc->writers.asymmetric);
+    assert(spsc->readers.asymmetric == supported);
+    assert(spsc->writers.asymmetric == supported);
+
+    // a small ring makes both sides park over and over.
+    thrd_t consumer;
+    thrd_create(&consumer, spsc_consumer, q);
+    for (long i = 1; i <= 100000; i++)
+        queueEnqueue(q, (void *)i);
+    int ok;
+    thrd_join(consumer, &ok);
+    assert(ok);
+
+    queueDestroy(q);
+
+    printf("SPSC parking lots test passed.\n");
+}
+
 int main()
 {
     test_destroyQueue();
@@ -547,6 +590,7 @@ int main()
     test_enqueue_dequeue_with_sleep();
     test_edge_cases();
     test_mixed_operations();
+    test_spsc_asymmetric_lots();
 
     return 0;
 }
@@ -3,6 +3,8 @@
 #include <threads.h>
 #include <stdatomic.h>
 #include <assert.h>
+#include <poll.h>
+#include <unistd.h>
 #include "queue.h"
 
 // Helper function to print test results
@@ -428,6 +430,1016 @@ void test_thread_wakeup_order()
     destroyQueue();
 }
 
+// Function to test that queue handles are independent of each other
+void test_multiple_handles()
+{
+    QueueHandle *first = queueCreate();
+    QueueHandle *second = queueCreate();
+
+    queueEnqueue(first, (void *)(long)1);
+    queueEnqueue(first, (void *)(long)2);
+    queueEnqueue(second, (void *)(long)3);
+    print_result("Multiple Handles - Sizes are independent", queueSize(first) == 2 && queueSize(second) == 1);
+
+    bool correct = (long)queueDequeue(second) == 3 && (long)queueDequeue(first) == 1;
+    void *item;
+    correct = correct && !queueTryDequeue(second, &item);
+    correct = correct && queueTryDequeue(first, &item) && (long)item == 2;
+    print_result("Multiple Handles - Items stay in their own queue", correct);
+    print_result("Multiple Handles - Visited is per queue", queueVisited(first) == 2 && queueVisited(second) == 1);
+
+    queueDestroy(first);
+    queueDestroy(second);
+}
+
+// Helper function to print the result of a check made on one of the queue modes
+void print_mode_result(const char *mode_name, const char *check, bool result)
+{
+    char test_name[128];
+    snprintf(test_name, sizeof(test_name), "%s - %s", mode_name, check);
+    print_result(test_name, result);
+}
+
+// Function to test a queue mode with blocked consumers and concurrent producers
+void test_queue_mode(QueueMode mode, const char *mode_name)
+{
+    QueueOptions options = {.mode = mode};
+    QueueHandle *q = queueCreateWithOptions(&options);
+
+    const int num_threads = 4;
+    const int num_items_per_thread = 1000;
+    thrd_t producers[num_threads];
+    thrd_t consumers[num_threads];
+    atomic_long sum = ATOMIC_VAR_INIT(0);
+
+    int produce(void *arg)
+    {
+        long id = (long)arg;
+        for (int i = 0; i < num_items_per_thread; ++i)
+        {
+            queueEnqueue(q, (void *)(id * num_items_per_thread + i + 1));
+        }
+        return 0;
+    }
+
+    int consume(void *arg)
+    {
+        (void)arg;
+        for (int i = 0; i < num_items_per_thread; ++i)
+        {
+            atomic_fetch_add(&sum, (long)queueDequeue(q));
+        }
+        return 0;
+    }
+
+    // a monitor polls the counters without any lock while the queue is busy
+    atomic_bool done = ATOMIC_VAR_INIT(false);
+    bool counters_sane = true;
+    int monitor(void *arg)
+    {
+        (void)arg;
+        size_t last_visited = 0;
+        while (!atomic_load(&done))
+        {
+            size_t visited = queueVisited(q);
+            counters_sane = counters_sane && visited >= last_visited && queueSize(q) <= (size_t)num_threads * num_items_per_thread &&
+                            queueWaiting(q) <= (size_t)num_threads;
+            last_visited = visited;
+            thrd_yield();
+        }
+        return 0;
+    }
+
+    thrd_t monitor_thread;
+    thrd_create(&monitor_thread, monitor, NULL);
+
+    // Consumers start first so some of them block on the empty queue
+    for (long i = 0; i < num_threads; ++i)
+    {
+        thrd_create(&consumers[i], consume, NULL);
+    }
+    for (long i = 0; i < num_threads; ++i)
+    {
+        thrd_create(&producers[i], produce, (void *)i);
+    }
+    for (int i = 0; i < num_threads; ++i)
+    {
+        thrd_join(producers[i], NULL);
+        thrd_join(consumers[i], NULL);
+    }
+    atomic_store(&done, true);
+    thrd_join(monitor_thread, NULL);
+
+    long total = (long)num_threads * num_items_per_thread;
+    void *item;
+    print_mode_result(mode_name, "Every item dequeued once", sum == total * (total + 1) / 2);
+    print_mode_result(mode_name, "Counters sane while polled", counters_sane);
+    print_mode_result(mode_name, "Queue is empty", queueSize(q) == 0 && !queueTryDequeue(q, &item));
+    print_mode_result(mode_name, "Visited", queueVisited(q) == (size_t)total && queueWaiting(q) == 0);
+
+    queueDestroy(q);
+}
+
+// Function to test that the bounded ring refuses items when full and blocks producers until there is space
+void test_ring_backpressure()
+{
+    QueueOptions options = {.mode = QUEUE_MODE_RING, .capacity = 3};
+    QueueHandle *q = queueCreateWithOptions(&options);
+
+    // capacity 3 is rounded up to 4 slots
+    bool accepted = true;
+    for (long i = 1; i <= 4; ++i)
+    {
+        accepted = accepted && queueTryEnqueue(q, (void *)i);
+    }
+    print_result("Ring Backpressure - Fills up to the rounded capacity", accepted && queueSize(q) == 4);
+    print_result("Ring Backpressure - TryEnqueue fails when full", !queueTryEnqueue(q, (void *)(long)5));
+
+    // a blocking enqueue waits until a consumer frees a slot
+    thrd_t thread;
+    atomic_bool enqueued = ATOMIC_VAR_INIT(false);
+    int blocking_enqueue(void *arg)
+    {
+        (void)arg;
+        queueEnqueue(q, (void *)(long)5);
+        enqueued = true;
+        return 0;
+    }
+    thrd_create(&thread, blocking_enqueue, NULL);
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 200000000}, NULL);
+    print_result("Ring Backpressure - Enqueue blocks when full", !enqueued);
+
+    bool fifo = (long)queueDequeue(q) == 1;
+    thrd_join(thread, NULL);
+    print_result("Ring Backpressure - Enqueue unblocks after a dequeue", enqueued);
+    for (long i = 2; i <= 5; ++i)
+    {
+        fifo = fifo && (long)queueDequeue(q) == i;
+    }
+    print_result("Ring Backpressure - FIFO order", fifo && queueVisited(q) == 5);
+
+    queueDestroy(q);
+}
+
+// Function to test that enqueueMany serves blocked consumers first and queues the rest in order
+void test_enqueue_many(QueueMode mode, const char *mode_name)
+{
+    QueueOptions options = {.mode = mode};
+    QueueHandle *q = queueCreateWithOptions(&options);
+
+    const int num_waiters = 2;
+    thrd_t threads[num_waiters];
+    long received[num_waiters];
+
+    int wait_for_item(void *arg)
+    {
+        long id = (long)arg;
+        received[id] = (long)queueDequeue(q);
+        return 0;
+    }
+
+    // Start the waiters one after the other so their order is known
+    for (long i = 0; i < num_waiters; ++i)
+    {
+        thrd_create(&threads[i], wait_for_item, (void *)i);
+        thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000}, NULL);
+    }
+
+    void *items[] = {(void *)1L, (void *)2L, (void *)3L, (void *)4L, (void *)5L};
+    queueEnqueueMany(q, items, 5);
+    for (int i = 0; i < num_waiters; ++i)
+    {
+        thrd_join(threads[i], NULL);
+    }
+
+    print_mode_result(mode_name, "EnqueueMany - Waiters served in order", received[0] == 1 && received[1] == 2);
+    print_mode_result(mode_name, "EnqueueMany - Remaining items queued", queueSize(q) == 3);
+    bool fifo = true;
+    for (long i = 3; i <= 5; ++i)
+    {
+        fifo = fifo && (long)queueDequeue(q) == i;
+    }
+    print_mode_result(mode_name, "EnqueueMany - FIFO order", fifo && queueVisited(q) == 5);
+
+    queueDestroy(q);
+}
+
+void test_dequeue_many(QueueMode mode, const char *mode_name)
+{
+    QueueOptions options = {.mode = mode};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    void *out[8];
+
+    print_mode_result(mode_name, "DequeueMany - Empty try", queueTryDequeueMany(q, out, 8) == 0);
+
+    for (long i = 1; i <= 5; ++i)
+    {
+        queueEnqueue(q, (void *)i);
+    }
+    size_t taken = queueTryDequeueMany(q, out, 3);
+    print_mode_result(mode_name, "DequeueMany - Takes at most max", taken == 3 && queueSize(q) == 2 && queueVisited(q) == 3);
+    taken = queueDequeueMany(q, out + 3, 8);
+    bool fifo = taken == 2;
+    for (long i = 0; i < 5; ++i)
+    {
+        fifo = fifo && (long)out[i] == i + 1;
+    }
+    print_mode_result(mode_name, "DequeueMany - FIFO order", fifo && queueSize(q) == 0 && queueVisited(q) == 5);
+
+    size_t blocked_taken = 0;
+    int take_many(void *arg)
+    {
+        blocked_taken = queueDequeueMany(q, out, 8);
+        return 0;
+    }
+
+    thrd_t consumer;
+    thrd_create(&consumer, take_many, NULL);
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000}, NULL);
+    queueEnqueue(q, (void *)6L);
+    thrd_join(consumer, NULL);
+    print_mode_result(mode_name, "DequeueMany - Blocks for an item", blocked_taken >= 1 && (long)out[0] == 6);
+
+    queueDestroy(q);
+}
+
+void test_dequeue_timeout(QueueMode mode, const char *mode_name)
+{
+    QueueOptions options = {.mode = mode};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    struct timespec start, deadline, end;
+    void *item = NULL;
+
+    timespec_get(&start, TIME_UTC);
+    deadline = start;
+    deadline.tv_nsec += 100000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    bool got = queueDequeueTimeout(q, &item, &deadline);
+    timespec_get(&end, TIME_UTC);
+    long waited_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    print_mode_result(mode_name, "DequeueTimeout - Times out on empty queue", !got && waited_ms >= 90 && queueWaiting(q) == 0);
+
+    // the timed out consumer must not be handed anything anymore.
+    queueEnqueue(q, (void *)7L);
+    print_mode_result(mode_name, "DequeueTimeout - Item after timeout is queued", queueSize(q) == 1);
+    got = queueDequeueTimeout(q, &item, &deadline);
+    print_mode_result(mode_name, "DequeueTimeout - Returns available item", got && (long)item == 7);
+
+    int produce_later(void *arg)
+    {
+        thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 50000000}, NULL);
+        queueEnqueue(q, (void *)8L);
+        return 0;
+    }
+
+    thrd_t producer;
+    thrd_create(&producer, produce_later, NULL);
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += 5;
+    got = queueDequeueTimeout(q, &item, &deadline);
+    thrd_join(producer, NULL);
+    print_mode_result(mode_name, "DequeueTimeout - Wakes up for an item", got && (long)item == 8 && queueVisited(q) == 2);
+
+    queueDestroy(q);
+}
+
+void test_batches_across_chunks()
+{
+    QueueHandle *q = queueCreate();
+    const long num_items = 1000;
+    void *batch[150];
+
+    for (long i = 0; i < num_items; i += 100)
+    {
+        for (long k = 0; k < 100; ++k)
+        {
+            batch[k] = (void *)(i + k);
+        }
+        queueEnqueueMany(q, batch, 100);
+    }
+
+    bool fifo = true;
+    long expected = 0;
+    while (expected < num_items / 2)
+    {
+        size_t taken = queueTryDequeueMany(q, batch, 150);
+        for (size_t k = 0; k < taken; ++k)
+        {
+            fifo = fifo && (long)batch[k] == expected++;
+        }
+    }
+    while (fifo && expected < num_items)
+    {
+        fifo = (long)queueDequeue(q) == expected++;
+    }
+    print_result("Batches Across Chunks - FIFO order", fifo && queueSize(q) == 0 && queueVisited(q) == num_items);
+
+    // leftovers are freed by destroy.
+    queueEnqueueMany(q, batch, 150);
+    queueDestroy(q);
+}
+
+// Function to test that a consumer steals from the shards of other threads and that counters cover all shards
+void test_sharded_stealing()
+{
+    QueueOptions options = {.mode = QUEUE_MODE_SHARDED, .shards = 4};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    const int num_producers = 3;
+    const long num_items = 100;
+    thrd_t producers[num_producers];
+
+    int produce(void *arg)
+    {
+        long id = (long)arg;
+        for (long i = 0; i < num_items; ++i)
+        {
+            queueEnqueue(q, (void *)(id * num_items + i + 1));
+        }
+        return 0;
+    }
+
+    for (long i = 0; i < num_producers; ++i)
+    {
+        thrd_create(&producers[i], produce, (void *)i);
+    }
+    for (int i = 0; i < num_producers; ++i)
+    {
+        thrd_join(producers[i], NULL);
+    }
+    print_result("Sharded - Size over all shards", queueSize(q) == (size_t)(num_producers * num_items));
+
+    // items of one producer must come out in order, whichever shard they were stolen from.
+    long last[num_producers];
+    bool in_order = true;
+    void *item;
+    for (int i = 0; i < num_producers; ++i)
+    {
+        last[i] = 0;
+    }
+    while (queueTryDequeue(q, &item))
+    {
+        long id = ((long)item - 1) / num_items;
+        in_order = in_order && (long)item > last[id];
+        last[id] = (long)item;
+    }
+    print_result("Sharded - Steals everything, FIFO per producer", in_order && queueSize(q) == 0 && queueVisited(q) == (size_t)(num_producers * num_items));
+
+    queueDestroy(q);
+}
+
+// Function to test the sharded mode with its shards spread over the NUMA nodes (one node on most test machines)
+void test_numa_shards()
+{
+    QueueOptions options = {.mode = QUEUE_MODE_SHARDED, .shards = 3, .numa = true};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    const long num_items = 1000;
+    void *item;
+    bool fifo = true;
+
+    for (long i = 1; i <= num_items; ++i)
+    {
+        queueEnqueue(q, (void *)i);
+    }
+    print_result("NUMA Shards - Size over all shards", queueSize(q) == (size_t)num_items);
+
+    // a single thread always uses the same home shard, so its own items come back in order.
+    for (long i = 1; i <= num_items; ++i)
+    {
+        fifo = fifo && queueTryDequeue(q, &item) && (long)item == i;
+    }
+    print_result("NUMA Shards - Home shard FIFO", fifo && !queueTryDequeue(q, &item) && queueVisited(q) == (size_t)num_items);
+
+    queueDestroy(q);
+}
+
+// Function to test the single producer single consumer ring with one thread on each side
+void test_spsc()
+{
+    QueueOptions options = {.mode = QUEUE_MODE_SPSC, .capacity = 64};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    const long num_items = 100000;
+    bool fifo = true;
+
+    int produce(void *arg)
+    {
+        (void)arg;
+        for (long i = 1; i <= num_items; ++i)
+        {
+            queueEnqueue(q, (void *)i);
+        }
+        return 0;
+    }
+
+    thrd_t producer;
+    thrd_create(&producer, produce, NULL);
+    for (long i = 1; i <= num_items; ++i)
+    {
+        fifo = fifo && (long)queueDequeue(q) == i;
+    }
+    thrd_join(producer, NULL);
+    print_result("SPSC - FIFO across threads", fifo && queueSize(q) == 0 && queueVisited(q) == (size_t)num_items);
+
+    for (long i = 0; i < 64; ++i)
+    {
+        queueTryEnqueue(q, (void *)i);
+    }
+    print_result("SPSC - TryEnqueue fails when full", !queueTryEnqueue(q, (void *)64L) && queueSize(q) == 64);
+
+    queueDestroy(q);
+}
+
+// Function to test that dequeue serves the highest priority lane first and FIFO within a lane
+void test_priority_lanes()
+{
+    QueueHandle *q = queueCreate();
+
+    queueEnqueue(q, (void *)1L);
+    queueEnqueue(q, (void *)2L);
+    queueEnqueuePriority(q, (void *)3L, 5);
+    queueEnqueuePriority(q, (void *)4L, QUEUE_PRIORITY_LANES - 1);
+    queueEnqueuePriority(q, (void *)5L, 1000); // clamped to the highest lane
+    queueEnqueuePriority(q, (void *)6L, 5);
+
+    long expected[] = {4, 5, 3, 6, 1, 2};
+    void *items[6];
+    bool ordered = queueDequeue(q) == (void *)expected[0];
+    size_t taken = queueTryDequeueMany(q, items, 6);
+    ordered = ordered && taken == 5;
+    for (size_t i = 0; i < taken; ++i)
+    {
+        ordered = ordered && (long)items[i] == expected[i + 1];
+    }
+    print_result("Priority Lanes - Highest lane first, FIFO within a lane", ordered && queueSize(q) == 0 && queueVisited(q) == 6);
+
+    long received = 0;
+    int wait_for_item(void *arg)
+    {
+        (void)arg;
+        received = (long)queueDequeue(q);
+        return 0;
+    }
+
+    thrd_t consumer;
+    thrd_create(&consumer, wait_for_item, NULL);
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000}, NULL);
+    queueEnqueuePriority(q, (void *)7L, 3);
+    thrd_join(consumer, NULL);
+    print_result("Priority Lanes - Waiter wakes for any lane", received == 7 && queueWaiting(q) == 0);
+
+    queueDestroy(q);
+}
+
+// Function to test the sojourn and wait histograms of a queue created with latency_stats
+void test_latency_stats()
+{
+    QueueOptions options = {.latency_stats = true};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    QueueStats stats;
+
+    queueEnqueue(q, (void *)1L);
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 20000000}, NULL);
+    bool item_ok = queueDequeue(q) == (void *)1L;
+    queueStats(q, &stats);
+    print_result("Latency Stats - Items come back unchanged", item_ok);
+    print_result("Latency Stats - Sojourn recorded", stats.sojourn.count == 1 && stats.sojourn.p50 >= 20000000 &&
+                                                           stats.sojourn.p50 <= stats.sojourn.max && stats.wait.count == 0);
+
+    long received = 0;
+    int wait_for_item(void *arg)
+    {
+        (void)arg;
+        received = (long)queueDequeue(q);
+        return 0;
+    }
+
+    thrd_t consumer;
+    thrd_create(&consumer, wait_for_item, NULL);
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 50000000}, NULL);
+    queueEnqueue(q, (void *)2L);
+    thrd_join(consumer, NULL);
+    queueStats(q, &stats);
+    print_result("Latency Stats - Wait recorded by the blocked thread", received == 2 && stats.wait.count == 1 &&
+                                                                              stats.wait.min >= 40000000 && stats.sojourn.count == 2);
+
+    // items still queued at destroy are the caller's, their stamps go with the queue's storage
+    queueEnqueue(q, (void *)3L);
+    queueDestroy(q);
+
+    // every mode keeps the stamps in its own storage, including the modes that hand items to waiters and the intrusive one
+    QueueLink links[4];
+    bool every_mode = true;
+    for (QueueMode mode = QUEUE_MODE_LOCKED; mode <= QUEUE_MODE_MULTI; ++mode)
+    {
+        QueueOptions mode_options = {.mode = mode, .latency_stats = true};
+        QueueHandle *mq = queueCreateWithOptions(&mode_options);
+        void *items[4] = {&links[0], &links[1], &links[2], &links[3]};
+        void *out[4];
+        queueEnqueue(mq, items[0]);
+        queueEnqueueMany(mq, items + 1, 2);
+        thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 1000000}, NULL);
+        size_t taken = queueTryDequeueMany(mq, out, 2);
+        while (taken < 3 && queueTryDequeue(mq, &out[taken]))
+        {
+            taken++;
+        }
+        bool try_ok = queueTryEnqueue(mq, items[3]);
+        bool dequeued = queueDequeue(mq) == items[3];
+        every_mode = every_mode && mq != NULL && taken == 3 && try_ok && dequeued && queueStats(mq, &stats) &&
+                     stats.sojourn.count == 4 && stats.sojourn.max >= 1000000;
+        queueDestroy(mq);
+    }
+    print_result("Latency Stats - Every mode", every_mode);
+
+    // one thread recording into more queues than it used to cache histograms for
+    const int num_queues = 6;
+    QueueHandle *queues[num_queues];
+    for (int i = 0; i < num_queues; ++i)
+    {
+        queues[i] = queueCreateWithOptions(&options);
+    }
+    for (int round = 0; round < 3; ++round)
+    {
+        for (int i = 0; i < num_queues; ++i)
+        {
+            for (int n = 0; n <= i; ++n)
+            {
+                queueEnqueue(queues[i], (void *)1L);
+                queueDequeue(queues[i]);
+            }
+        }
+    }
+    bool counted = true;
+    for (int i = 0; i < num_queues; ++i)
+    {
+        counted = counted && queueStats(queues[i], &stats) && stats.sojourn.count == 3 * (uint64_t)(i + 1);
+        queueDestroy(queues[i]);
+    }
+    print_result("Latency Stats - Many queues per thread", counted);
+
+    QueueHandle *plain = queueCreate();
+    print_result("Latency Stats - Off by default", !queueStats(plain, &stats));
+    queueDestroy(plain);
+}
+
+// Function to test the lock profile, which only exists when built with -DQUEUE_PROFILE_LOCKS
+void test_lock_stats()
+{
+    QueueHandle *q = queueCreate();
+    QueueLockStats stats;
+    void *item;
+
+    queueEnqueue(q, (void *)1L);
+    queueEnqueue(q, (void *)2L);
+    queueTryDequeue(q, &item);
+    queueDequeue(q);
+
+    long received = 0;
+    int wait_for_item(void *arg)
+    {
+        (void)arg;
+        received = (long)queueDequeue(q);
+        return 0;
+    }
+
+    thrd_t consumer;
+    thrd_create(&consumer, wait_for_item, NULL);
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000}, NULL);
+    queueEnqueue(q, (void *)3L);
+    thrd_join(consumer, NULL);
+
+    bool collected = queueLockStats(q, &stats);
+#ifdef QUEUE_PROFILE_LOCKS
+    print_result("Lock Stats - Acquisitions counted", collected && stats.enqueue.acquisitions == 3 && stats.try_dequeue.acquisitions >= 2 &&
+                                                          stats.dequeue.acquisitions >= 1);
+    print_result("Lock Stats - Parks and wakes counted", received == 3 && stats.parks == 1 && stats.wakes == 1);
+#else
+    print_result("Lock Stats - Compiled out", !collected && received == 3);
+#endif
+
+    queueDestroy(q);
+}
+
+// Function to test the intrusive mode: items are linked through a QueueLink of their own
+void test_intrusive()
+{
+    typedef struct Message
+    {
+        long id;
+        QueueLink link;
+    } Message;
+
+    QueueOptions options = {.mode = QUEUE_MODE_INTRUSIVE};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    const long num_items = 1000;
+    Message *messages = malloc(num_items * sizeof(Message));
+
+    int consume(void *arg)
+    {
+        long *sum = (long *)arg;
+        for (long i = 0; i < num_items / 2; ++i)
+        {
+            *sum += QUEUE_LINK_ITEM(queueDequeue(q), Message, link)->id;
+        }
+        return 0;
+    }
+
+    long sum = 0;
+    thrd_t consumer;
+    thrd_create(&consumer, consume, &sum);
+    for (long i = 0; i < num_items; ++i)
+    {
+        messages[i].id = i;
+        queueEnqueue(q, &messages[i].link);
+    }
+    thrd_join(consumer, NULL);
+    print_result("Intrusive - Blocking consumer gets its items", sum == (num_items / 2 - 1) * (num_items / 2) / 2);
+
+    bool fifo = true;
+    void *links[64];
+    long expected = num_items / 2;
+    size_t taken;
+    while ((taken = queueTryDequeueMany(q, links, 64)) > 0)
+    {
+        for (size_t k = 0; k < taken; ++k)
+        {
+            fifo = fifo && QUEUE_LINK_ITEM(links[k], Message, link) == &messages[expected++];
+        }
+    }
+    print_result("Intrusive - Items come back in FIFO order", fifo && expected == num_items && queueSize(q) == 0 && queueVisited(q) == (size_t)num_items);
+
+    // leftovers still belong to the caller.
+    queueEnqueue(q, &messages[0].link);
+    queueDestroy(q);
+    free(messages);
+
+    // the links have no room for a stamp, the queue keeps the enqueue times beside them.
+    QueueOptions stats_options = {.mode = QUEUE_MODE_INTRUSIVE, .latency_stats = true};
+    q = queueCreateWithOptions(&stats_options);
+    QueueStats stats;
+    Message stamped[3];
+    for (long i = 0; i < 3; ++i)
+    {
+        stamped[i].id = i;
+        queueEnqueue(q, &stamped[i].link);
+    }
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 5000000}, NULL);
+    bool in_order = QUEUE_LINK_ITEM(queueDequeue(q), Message, link)->id == 0 && queueTryDequeueMany(q, links, 64) == 2 &&
+                    QUEUE_LINK_ITEM(links[1], Message, link)->id == 2;
+    print_result("Intrusive - Latency stats", in_order && queueStats(q, &stats) && stats.sojourn.count == 3 &&
+                                                  stats.sojourn.min >= 5000000);
+    queueDestroy(q);
+}
+
+// Function to test the relaxed FIFO of the multi queue: every item comes out once, and never far behind newer ones
+void test_multi_queue()
+{
+    QueueOptions options = {.mode = QUEUE_MODE_MULTI, .shards = 4};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    const long num_items = 10000;
+    bool *seen = calloc(num_items + 1, sizeof(bool));
+    bool once = true;
+    long newest = 0;
+    long lag = 0;
+    void *item;
+
+    for (long i = 1; i <= num_items; ++i)
+    {
+        queueEnqueue(q, (void *)i);
+    }
+    print_result("Multi Queue - Size over all lists", queueSize(q) == (size_t)num_items);
+
+    // lag: how many newer items already came out when an item is dequeued.
+    while (queueTryDequeue(q, &item))
+    {
+        long value = (long)item;
+        once = once && value >= 1 && value <= num_items && !seen[value];
+        seen[value] = true;
+        if (value > newest)
+        {
+            newest = value;
+        }
+        if (newest - value > lag)
+        {
+            lag = newest - value;
+        }
+    }
+    print_result("Multi Queue - Every item dequeued once", once && queueSize(q) == 0 && queueVisited(q) == (size_t)num_items);
+    print_result("Multi Queue - Close to FIFO", lag < 1000);
+
+    free(seen);
+    queueDestroy(q);
+}
+
+// Function to test the node pool of the two lock mode: slabs freed above the high watermark, per thread caches
+// of threads that exit or outlive their queue
+void test_node_pool()
+{
+    QueueOptions options = {.mode = QUEUE_MODE_TWO_LOCK, .pool_high_watermark = 1};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    const long num_items = 5000;
+
+    // every burst fills many slabs, which are freed again once it is drained
+    bool fifo = true;
+    for (int round = 0; round < 3; ++round)
+    {
+        for (long i = 1; i <= num_items; ++i)
+        {
+            queueEnqueue(q, (void *)i);
+        }
+        for (long i = 1; i <= num_items; ++i)
+        {
+            fifo = fifo && (long)queueDequeue(q) == i;
+        }
+    }
+    print_result("Node Pool - Bursts above the high watermark", fifo && queueSize(q) == 0 && queueVisited(q) == 3 * (size_t)num_items);
+
+    // the nodes a consumer frees sit in its thread cache until it exits, later producers allocate them again
+    long sums[3] = {0};
+    int produce(void *arg)
+    {
+        (void)arg;
+        for (long i = 1; i <= num_items; ++i)
+        {
+            queueEnqueue(q, (void *)i);
+        }
+        return 0;
+    }
+    int consume(void *arg)
+    {
+        long *sum = (long *)arg;
+        for (long i = 1; i <= num_items; ++i)
+        {
+            *sum += (long)queueDequeue(q);
+        }
+        return 0;
+    }
+    for (int round = 0; round < 3; ++round)
+    {
+        thrd_t producer, consumer;
+        thrd_create(&consumer, consume, &sums[round]);
+        thrd_create(&producer, produce, NULL);
+        thrd_join(producer, NULL);
+        thrd_join(consumer, NULL);
+    }
+    bool sums_match = true;
+    for (int round = 0; round < 3; ++round)
+    {
+        sums_match = sums_match && sums[round] == num_items * (num_items + 1) / 2;
+    }
+    print_result("Node Pool - Threads exit before destroy", sums_match && queueSize(q) == 0);
+    queueDestroy(q);
+
+    // a thread still caching nodes of a destroyed queue, and a new queue possibly at the same address
+    atomic_int step = ATOMIC_VAR_INIT(0);
+    QueueHandle *current = queueCreateWithOptions(&options);
+    bool reused_fifo = true;
+    int outlive(void *arg)
+    {
+        (void)arg;
+        for (int round = 0; round < 2; ++round)
+        {
+            for (long i = 1; i <= 100; ++i)
+            {
+                queueEnqueue(current, (void *)i);
+            }
+            for (long i = 1; i <= 100; ++i)
+            {
+                reused_fifo = reused_fifo && (long)queueDequeue(current) == i;
+            }
+            atomic_store(&step, 2 * round + 1);
+            while (atomic_load(&step) == 2 * round + 1)
+            {
+                thrd_yield();
+            }
+        }
+        return 0;
+    }
+    thrd_t thread;
+    thrd_create(&thread, outlive, NULL);
+    while (atomic_load(&step) != 1)
+    {
+        thrd_yield();
+    }
+    queueDestroy(current);
+    current = queueCreateWithOptions(&options);
+    atomic_store(&step, 2);
+    while (atomic_load(&step) != 3)
+    {
+        thrd_yield();
+    }
+    atomic_store(&step, 4);
+    thrd_join(thread, NULL);
+    print_result("Node Pool - Thread outlives its queue", reused_fifo && queueVisited(current) == 100);
+    queueDestroy(current);
+
+    // one thread on more queues than it keeps node caches for
+    const int num_queues = 6;
+    QueueHandle *queues[num_queues];
+    for (int i = 0; i < num_queues; ++i)
+    {
+        queues[i] = queueCreateWithOptions(&options);
+    }
+    for (long i = 1; i <= 1000; ++i)
+    {
+        queueEnqueue(queues[i % num_queues], (void *)i);
+    }
+    bool each_fifo = true;
+    for (long i = 1; i <= 1000; ++i)
+    {
+        each_fifo = each_fifo && (long)queueDequeue(queues[i % num_queues]) == i;
+    }
+    for (int i = 0; i < num_queues; ++i)
+    {
+        each_fifo = each_fifo && queueSize(queues[i]) == 0;
+        queueDestroy(queues[i]);
+    }
+    print_result("Node Pool - More queues than thread caches", each_fifo);
+}
+
+// Function to test that the waiter records of exited consumers are reused by new ones
+void test_waiter_reuse()
+{
+    QueueHandle *q = queueCreate();
+    const int num_rounds = 50;
+    bool received = true;
+    struct timespec deadline;
+    void *item;
+
+    int wait_for_item(void *arg)
+    {
+        received = received && queueDequeue(q) == arg;
+        return 0;
+    }
+
+    // every consumer parks, is woken and exits, its record goes to the next thread
+    for (long i = 1; i <= num_rounds; ++i)
+    {
+        thrd_t consumer;
+        thrd_create(&consumer, wait_for_item, (void *)i);
+        while (queueWaiting(q) == 0)
+        {
+            thrd_yield();
+        }
+        queueEnqueue(q, (void *)i);
+        thrd_join(consumer, NULL);
+    }
+    print_result("Waiter Reuse - Short lived consumers", received && queueWaiting(q) == 0 && queueVisited(q) == num_rounds);
+
+    // a consumer that timed out and exited must not be handed anything, nor hand its record out twice
+    int wait_briefly(void *arg)
+    {
+        (void)arg;
+        timespec_get(&deadline, TIME_UTC);
+        deadline.tv_nsec += 10000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        return queueDequeueTimeout(q, &item, &deadline);
+    }
+    thrd_t first, second;
+    int got_item;
+    thrd_create(&first, wait_briefly, NULL);
+    thrd_join(first, &got_item);
+    queueEnqueue(q, (void *)1L);
+    bool queued = !got_item && queueSize(q) == 1;
+    thrd_create(&second, wait_briefly, NULL);
+    thrd_create(&first, wait_for_item, (void *)2L);
+    thrd_join(second, NULL);
+    while (queueWaiting(q) == 0)
+    {
+        thrd_yield();
+    }
+    queueEnqueue(q, (void *)2L);
+    thrd_join(first, NULL);
+    print_result("Waiter Reuse - Timed out consumer not handed items", queued && received && queueSize(q) == 0 && queueWaiting(q) == 0);
+
+    queueDestroy(q);
+}
+
+// Function to test that an enqueue hands its item straight to a parked consumer, so nobody else can take it
+void test_hand_over(QueueMode mode, const char *mode_name)
+{
+    QueueOptions options = {.mode = mode};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    void *received = NULL;
+    void *item;
+
+    int wait_for_item(void *arg)
+    {
+        (void)arg;
+        received = queueDequeue(q);
+        return 0;
+    }
+
+    thrd_t consumer;
+    thrd_create(&consumer, wait_for_item, NULL);
+    while (queueWaiting(q) == 0)
+    {
+        thrd_yield();
+    }
+    queueEnqueue(q, (void *)1L);
+    bool not_queued = queueSize(q) == 0 && !queueTryDequeue(q, &item);
+    thrd_join(consumer, NULL);
+    print_mode_result(mode_name, "Hand Over - Item goes to the parked consumer", not_queued && (long)received == 1 && queueVisited(q) == 1);
+
+    queueDestroy(q);
+}
+
+// Function to test the LIFO wake policy: the consumer that parked last gets the first item
+void test_lifo_wakeup(QueueMode mode, const char *mode_name)
+{
+    // links, so the same items work for the intrusive mode
+    typedef struct Message
+    {
+        long id;
+        QueueLink link;
+    } Message;
+
+    QueueOptions options = {.mode = mode, .wake_policy = QUEUE_WAKE_LIFO};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    const int num_waiters = 3;
+    thrd_t threads[num_waiters];
+    long received[num_waiters];
+    Message messages[num_waiters];
+
+    int wait_for_item(void *arg)
+    {
+        long id = (long)arg;
+        received[id] = QUEUE_LINK_ITEM(queueDequeue(q), Message, link)->id;
+        return 0;
+    }
+
+    // Start the waiters one after the other so their order is known
+    for (long i = 0; i < num_waiters; ++i)
+    {
+        thrd_create(&threads[i], wait_for_item, (void *)i);
+        thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000}, NULL);
+    }
+    for (long i = 0; i < num_waiters; ++i)
+    {
+        messages[i].id = i;
+        queueEnqueue(q, &messages[i].link);
+    }
+    for (int i = 0; i < num_waiters; ++i)
+    {
+        thrd_join(threads[i], NULL);
+    }
+
+    print_mode_result(mode_name, "Wake LIFO - Last parked woken first", received[0] == 2 && received[1] == 1 && received[2] == 0);
+    queueDestroy(q);
+}
+
+// Function to test the readiness eventfd: signalled once per empty to non-empty edge, cleared by an empty tryDequeue
+void test_event_fd(QueueMode mode, const char *mode_name)
+{
+    QueueOptions options = {.mode = mode, .event_fd = true};
+    QueueHandle *q = queueCreateWithOptions(&options);
+    int fd = queueEventFd(q);
+    struct pollfd ready = {.fd = fd, .events = POLLIN};
+    uint64_t signals = 0;
+    void *item;
+
+    print_mode_result(mode_name, "EventFd - Not readable while empty", fd >= 0 && poll(&ready, 1, 0) == 0);
+
+    queueEnqueue(q, (void *)1L);
+    queueEnqueue(q, (void *)2L);
+    queueEnqueue(q, (void *)3L);
+    print_mode_result(mode_name, "EventFd - One signal for a burst",
+                      poll(&ready, 1, 0) == 1 && read(fd, &signals, sizeof(signals)) == sizeof(signals) && signals == 1);
+
+    int drained = 0;
+    while (queueTryDequeue(q, &item))
+    {
+        drained++;
+    }
+    print_mode_result(mode_name, "EventFd - Drained and rearmed", drained == 3 && poll(&ready, 1, 0) == 0);
+
+    int produce(void *arg)
+    {
+        thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 50000000}, NULL);
+        queueEnqueue(q, arg);
+        return 0;
+    }
+    thrd_t producer;
+    thrd_create(&producer, produce, (void *)4L);
+    bool woken = poll(&ready, 1, 5000) == 1 && queueTryDequeue(q, &item) && (long)item == 4;
+    thrd_join(producer, NULL);
+    print_mode_result(mode_name, "EventFd - Wakes a polling consumer", woken);
+
+    queueDestroy(q);
+
+    QueueOptions plain_options = {.mode = mode};
+    QueueHandle *plain = queueCreateWithOptions(&plain_options);
+    print_mode_result(mode_name, "EventFd - None without the option", queueEventFd(plain) == -1);
+    queueDestroy(plain);
+}
+
 int main()
 {
     test_basic_functionality();
@@ -440,6 +1452,53 @@ int main()
     test_large_data();
     test_random_operations();
     test_thread_wakeup_order();
+    test_waiter_reuse();
+    test_hand_over(QUEUE_MODE_LOCKED, "Locked Mode");
+    test_hand_over(QUEUE_MODE_TWO_LOCK, "Two Lock Mode");
+    test_lifo_wakeup(QUEUE_MODE_LOCKED, "Locked Mode");
+    test_lifo_wakeup(QUEUE_MODE_TWO_LOCK, "Two Lock Mode");
+    test_lifo_wakeup(QUEUE_MODE_INTRUSIVE, "Intrusive Mode");
+    test_multiple_handles();
+    test_queue_mode(QUEUE_MODE_LOCKED, "Locked Mode");
+    test_queue_mode(QUEUE_MODE_TWO_LOCK, "Two Lock Mode");
+    test_queue_mode(QUEUE_MODE_LOCK_FREE, "Lock Free Mode");
+    test_queue_mode(QUEUE_MODE_RING, "Ring Mode");
+    test_queue_mode(QUEUE_MODE_SHARDED, "Sharded Mode");
+    test_queue_mode(QUEUE_MODE_COMBINING, "Combining Mode");
+    test_queue_mode(QUEUE_MODE_MULTI, "Multi Mode");
+    test_sharded_stealing();
+    test_numa_shards();
+    test_spsc();
+    test_intrusive();
+    test_multi_queue();
+    test_node_pool();
+    test_priority_lanes();
+    test_latency_stats();
+    test_lock_stats();
+    test_ring_backpressure();
+    test_enqueue_many(QUEUE_MODE_LOCKED, "Locked Mode");
+    test_enqueue_many(QUEUE_MODE_TWO_LOCK, "Two Lock Mode");
+    test_dequeue_many(QUEUE_MODE_LOCKED, "Locked Mode");
+    test_dequeue_many(QUEUE_MODE_TWO_LOCK, "Two Lock Mode");
+    test_dequeue_many(QUEUE_MODE_LOCK_FREE, "Lock Free Mode");
+    test_dequeue_many(QUEUE_MODE_RING, "Ring Mode");
+    test_dequeue_many(QUEUE_MODE_SHARDED, "Sharded Mode");
+    test_dequeue_many(QUEUE_MODE_SPSC, "SPSC Mode");
+    test_dequeue_many(QUEUE_MODE_COMBINING, "Combining Mode");
+    test_batches_across_chunks();
+    test_dequeue_timeout(QUEUE_MODE_LOCKED, "Locked Mode");
+    test_dequeue_timeout(QUEUE_MODE_TWO_LOCK, "Two Lock Mode");
+    test_dequeue_timeout(QUEUE_MODE_LOCK_FREE, "Lock Free Mode");
+    test_dequeue_timeout(QUEUE_MODE_RING, "Ring Mode");
+    test_dequeue_timeout(QUEUE_MODE_SHARDED, "Sharded Mode");
+    test_dequeue_timeout(QUEUE_MODE_SPSC, "SPSC Mode");
+    test_dequeue_timeout(QUEUE_MODE_COMBINING, "Combining Mode");
+    test_dequeue_timeout(QUEUE_MODE_MULTI, "Multi Mode");
+#ifdef __linux__
+    test_event_fd(QUEUE_MODE_LOCKED, "Locked Mode");
+    test_event_fd(QUEUE_MODE_LOCK_FREE, "Lock Free Mode");
+    test_event_fd(QUEUE_MODE_SHARDED, "Sharded Mode");
+#endif
 
     return 0;
 }
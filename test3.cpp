@@ -0,0 +1,206 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "queue.hpp"
+
+// Helper function to print test results
+void print_result(const char *test_name, bool result)
+{
+    printf("%s: %s\n", test_name, result ? "PASSED" : "FAILED");
+}
+
+// Queue<T> allocates its boxes with the aligned operator new, count them.
+static std::atomic<long> boxes_allocated{0};
+
+void *operator new(std::size_t size, std::align_val_t align)
+{
+    boxes_allocated++;
+    std::size_t alignment = static_cast<std::size_t>(align);
+    void *box = std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+    if (box == nullptr)
+        throw std::bad_alloc();
+    return box;
+}
+
+void operator delete(void *box, std::align_val_t) noexcept
+{
+    std::free(box);
+}
+
+void operator delete(void *box, std::size_t, std::align_val_t) noexcept
+{
+    std::free(box);
+}
+
+// counts live instances, so leaks and double destruction show up.
+struct Tracked
+{
+    static inline std::atomic<int> live{0};
+    std::string name;
+    long value;
+
+    Tracked(std::string name, long value) : name(std::move(name)), value(value)
+    {
+        live++;
+    }
+    Tracked(Tracked &&other) noexcept : name(std::move(other.name)), value(other.value)
+    {
+        live++;
+    }
+    Tracked &operator=(Tracked &&other) noexcept
+    {
+        name = std::move(other.name);
+        value = other.value;
+        return *this;
+    }
+    Tracked(const Tracked &) = delete;
+    ~Tracked()
+    {
+        live--;
+    }
+};
+
+// Function to test that small trivially copyable values go through the queue inline and in order
+void test_inline_values()
+{
+    Queue<int> q;
+    for (int i = -5; i < 5; ++i)
+    {
+        q.enqueue(i);
+    }
+    bool fifo = q.size() == 10;
+    for (int i = -5; i < 5; ++i)
+    {
+        fifo = fifo && q.dequeue() == i;
+    }
+    int item;
+    print_result("Queue<T> - Inline values in FIFO order", fifo && !q.tryDequeue(item) && q.visited() == 10);
+}
+
+// Function to test move only items and emplace
+void test_move_only()
+{
+    Queue<std::unique_ptr<long>> q;
+    q.enqueue(std::make_unique<long>(1));
+    q.emplace(new long(2));
+    std::unique_ptr<long> first = q.dequeue();
+    std::unique_ptr<long> second;
+    bool taken = q.tryDequeue(second);
+    print_result("Queue<T> - Move only items", taken && *first == 1 && *second == 2 && q.size() == 0);
+}
+
+// Function to test that items left in the queue are destroyed with it
+void test_leftovers_destroyed()
+{
+    {
+        Queue<Tracked> q;
+        for (long i = 0; i < 100; ++i)
+        {
+            q.emplace("item", i);
+        }
+        for (long i = 0; i < 50; ++i)
+        {
+            q.dequeue();
+        }
+    }
+    print_result("Queue<T> - Leftovers destroyed", Tracked::live == 0);
+}
+
+// Function to test that a refused tryEnqueue leaves the item with the caller
+void test_try_enqueue_full()
+{
+    QueueOptions options{};
+    options.mode = QUEUE_MODE_RING;
+    options.capacity = 2;
+    Queue<Tracked> q(options);
+    Tracked a("a", 1), b("b", 2), c("c", 3);
+    bool accepted = q.tryEnqueue(a) && q.tryEnqueue(b);
+    bool refused = !q.tryEnqueue(c);
+    print_result("Queue<T> - Refused item stays with the caller", accepted && refused && c.name == "c" && c.value == 3);
+}
+
+// Function to test several producers and consumers passing boxed items
+void test_threads()
+{
+    Queue<Tracked> q;
+    const int num_threads = 4;
+    const long num_items = 10000;
+    std::vector<std::thread> threads;
+    std::vector<long> sums(num_threads, 0);
+
+    for (int t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&q, t] {
+            for (long i = 1; i <= num_items; ++i)
+            {
+                q.emplace("message", t * num_items + i);
+            }
+        });
+        threads.emplace_back([&q, &sums, t] {
+            for (long i = 0; i < num_items; ++i)
+            {
+                sums[t] += q.dequeue().value;
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    long sum = 0;
+    for (long s : sums)
+    {
+        sum += s;
+    }
+    long total = num_threads * num_items;
+    print_result("Queue<T> - Every item dequeued once", sum == total * (total + 1) / 2 && q.size() == 0 && Tracked::live == 0);
+}
+
+// Function to test that a thread that only produces gets the boxes of the consumer back
+void test_boxes_recycled()
+{
+    QueueOptions options{};
+    options.mode = QUEUE_MODE_RING;
+    options.capacity = 64;
+    Queue<Tracked> q(options);
+    const long num_items = 100000;
+    long sum = 0;
+    long before = boxes_allocated;
+
+    std::thread producer([&q] {
+        for (long i = 1; i <= num_items; ++i)
+        {
+            q.emplace("message", i);
+        }
+    });
+    std::thread consumer([&q, &sum] {
+        for (long i = 0; i < num_items; ++i)
+        {
+            sum += q.dequeue().value;
+        }
+    });
+    producer.join();
+    consumer.join();
+
+    long allocated = boxes_allocated - before;
+    print_result("Queue<T> - Boxes go back to the producer",
+                 sum == num_items * (num_items + 1) / 2 && allocated < num_items / 10);
+}
+
+int main()
+{
+    test_inline_values();
+    test_move_only();
+    test_leftovers_destroyed();
+    test_try_enqueue_full();
+    test_threads();
+    test_boxes_recycled();
+
+    return 0;
+}